@@ -0,0 +1,483 @@
+/*
+ * Copyright (c) 2011-2012, Attila Gobi and Zalan Szugyi
+ * All rights reserved.
+ *
+ * This software was developed by Attila Gobi and Zalan Szugyi.
+ * The project was supported by the European Union and co-financed by the
+ * European Social Fund (grant agreement no. TAMOP 4.2.1./B-09/1/KMR-2010-0003)
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Benchmark suite, run by `make bench`.
+ *
+ * Every case builds its definition afresh for each trial, so memoized
+ * elements from one trial never serve the next. A case runs twice to
+ * warm up, then a number of timed trials on the monotonic clock. The
+ * summary goes to stderr and the results as JSON to stdout, in ns per
+ * element, so two versions can be compared run against run.
+ *
+ *     ./stream_bench [trials] > bench.json
+ *
+ * Built with STREAM_STATS (`make bench_stats`), it also runs every case
+ * once more untimed and reports the node counters of that run.
+ *
+ * On Linux every case also runs once under the hardware counters, which
+ * are reported per element. Counters the kernel or the container does not
+ * give out are left out of the summary and null in the JSON.
+ *
+ * The heavy cases stream a large element type that counts its copies and
+ * moves; one more run reports both per element.
+ */
+
+#include "stream.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#ifdef __linux__
+#include <cstring>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+typedef unsigned long value;
+
+/*
+ * Hardware counters of the calling thread, in user space only, one file
+ * descriptor per event so that each one works or fails on its own. When
+ * the events outnumber the hardware counters the kernel takes turns, and
+ * the counts are scaled up by the share of time each event was counted.
+ */
+class perf_counters
+{
+public:
+    enum event { cycles, instructions, l1d_misses, llc_misses, branch_misses, events };
+
+    static const char *name(event e)
+    {
+        static const char *const names[events] = {
+            "cycles", "instructions", "l1d_misses", "llc_misses", "branch_misses"
+        };
+        return names[e];
+    }
+
+    perf_counters()
+    {
+        for(int e=0; e<events; ++e) {
+            fd_[e] = open(event(e));
+            count_[e] = -1;
+        }
+    }
+
+    ~perf_counters()
+    {
+#ifdef __linux__
+        for(int e=0; e<events; ++e)
+            if(fd_[e] >= 0)
+                close(fd_[e]);
+#endif
+    }
+
+    bool any() const
+    {
+        for(int e=0; e<events; ++e)
+            if(fd_[e] >= 0)
+                return true;
+        return false;
+    }
+
+    void start()
+    {
+#ifdef __linux__
+        for(int e=0; e<events; ++e) {
+            if(fd_[e] < 0)
+                continue;
+            ioctl(fd_[e], PERF_EVENT_IOC_RESET, 0);
+            ioctl(fd_[e], PERF_EVENT_IOC_ENABLE, 0);
+        }
+#endif
+    }
+
+    void stop()
+    {
+#ifdef __linux__
+        for(int e=0; e<events; ++e) {
+            count_[e] = -1;
+            if(fd_[e] < 0)
+                continue;
+            ioctl(fd_[e], PERF_EVENT_IOC_DISABLE, 0);
+
+            // value, time enabled, time running
+            unsigned long long v[3];
+            if(read(fd_[e], v, sizeof(v)) == sizeof(v) && v[2])
+                count_[e] = double(v[0])*v[1]/v[2];
+        }
+#endif
+    }
+
+    // The last count between start() and stop(), negative if there is none.
+    double count(event e) const
+    {
+        return count_[e];
+    }
+
+private:
+    perf_counters(const perf_counters &);
+    perf_counters &operator=(const perf_counters &);
+
+    static int open(event e)
+    {
+#ifdef __linux__
+        perf_event_attr a;
+        std::memset(&a, 0, sizeof(a));
+        a.size = sizeof(a);
+        a.type = PERF_TYPE_HARDWARE;
+        switch(e) {
+            case cycles: a.config = PERF_COUNT_HW_CPU_CYCLES; break;
+            case instructions: a.config = PERF_COUNT_HW_INSTRUCTIONS; break;
+            case llc_misses: a.config = PERF_COUNT_HW_CACHE_MISSES; break;
+            case branch_misses: a.config = PERF_COUNT_HW_BRANCH_MISSES; break;
+            case l1d_misses:
+                a.type = PERF_TYPE_HW_CACHE;
+                a.config = PERF_COUNT_HW_CACHE_L1D |
+                    PERF_COUNT_HW_CACHE_OP_READ << 8 |
+                    PERF_COUNT_HW_CACHE_RESULT_MISS << 16;
+                break;
+            default: return -1;
+        }
+        a.disabled = 1;
+        a.exclude_kernel = 1;
+        a.exclude_hv = 1;
+        a.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        return syscall(__NR_perf_event_open, &a, 0, -1, -1, 0);
+#else
+        (void)e;
+        return -1;
+#endif
+    }
+
+    int fd_[events];
+    double count_[events];
+};
+
+struct result
+{
+    std::string name;
+    std::size_t size;
+    std::vector<double> ns;
+
+    // Per element, negative where the counter is not available.
+    double hw[perf_counters::events];
+
+    // Copies and moves of heavy values per element.
+    double copies, moves;
+#ifdef STREAM_STATS
+    stream_stats::counters stats[stream_stats::kinds];
+#endif
+
+    // Nearest rank on the sorted samples.
+    double percentile(double p) const
+    {
+        std::size_t i = std::size_t(p/100*(ns.size()-1) + .5);
+        return ns[i];
+    }
+};
+
+static volatile value sink;
+
+// A value as costly to copy as a vector of 64 doubles, which counts its
+// copies and moves.
+struct heavy
+{
+    heavy() { }
+
+    explicit heavy(double x)
+        :v(64, x)
+    { }
+
+    heavy(const heavy &o)
+        :v(o.v)
+    {
+        ++copies;
+    }
+
+    heavy(heavy &&o)
+        :v(std::move(o.v))
+    {
+        ++moves;
+    }
+
+    heavy &operator=(const heavy &o)
+    {
+        v = o.v;
+        ++copies;
+        return *this;
+    }
+
+    heavy &operator=(heavy &&o)
+    {
+        v = std::move(o.v);
+        ++moves;
+        return *this;
+    }
+
+    std::vector<double> v;
+    static unsigned long copies, moves;
+};
+
+unsigned long heavy::copies = 0;
+unsigned long heavy::moves = 0;
+
+template<typename F>
+result measure(const std::string &name, std::size_t n, int trials, perf_counters &pc, F f)
+{
+    const int warmup = 2;
+    for(int i=0; i<warmup; ++i)
+        sink = f(n);
+
+    result r;
+    r.name = name;
+    r.size = n;
+    for(int i=0; i<trials; ++i) {
+        std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
+        sink = f(n);
+        std::chrono::steady_clock::time_point t2 = std::chrono::steady_clock::now();
+        r.ns.push_back(std::chrono::duration<double, std::nano>(t2-t1).count()/n);
+    }
+    std::sort(r.ns.begin(), r.ns.end());
+
+    std::cerr<<name<<" "<<n<<": median "<<r.percentile(50)<<" ns/element"
+        <<" (p10 "<<r.percentile(10)<<", p90 "<<r.percentile(90)<<")"<<std::endl;
+
+    pc.start();
+    sink = f(n);
+    pc.stop();
+    bool any = false;
+    for(int e=0; e<perf_counters::events; ++e) {
+        const double c = pc.count(perf_counters::event(e));
+        r.hw[e] = c < 0 ? -1 : c/n;
+        if(c < 0)
+            continue;
+        std::cerr<<(any ? ", " : "    ")<<perf_counters::name(perf_counters::event(e))
+            <<" "<<r.hw[e];
+        any = true;
+    }
+    if(any)
+        std::cerr<<" per element"<<std::endl;
+
+    heavy::copies = heavy::moves = 0;
+    sink = f(n);
+    r.copies = double(heavy::copies)/n;
+    r.moves = double(heavy::moves)/n;
+    if(heavy::copies || heavy::moves)
+        std::cerr<<"    "<<r.copies<<" copies, "<<r.moves<<" moves per element"<<std::endl;
+
+#ifdef STREAM_STATS
+    stream_stats::reset();
+    sink = f(n);
+    stream_stats::print(std::cerr);
+    for(int k=0; k<stream_stats::kinds; ++k)
+        r.stats[k] = stream_stats::of(stream_stats::kind(k));
+#endif
+    return r;
+}
+
+value last(const stream<value> &s, std::size_t n)
+{
+    stream<value>::iterator it = s.begin();
+    for(std::size_t i=0; i<n; ++i) ++it;
+    return *it;
+}
+
+value fibonacci(std::size_t n)
+{
+    stream<value> s = 0ul<<=s+(1ul<<=s);
+    return last(s, n);
+}
+
+value fibonacci_forget(std::size_t n)
+{
+    stream<value> s = 0ul<<=s+(1ul<<=s);
+    s.forget();
+    return last(s, n);
+}
+
+value change(std::size_t n)
+{
+    stream<value> c1 = 1ul<<=c1;
+    stream<value> c2 = delay(2, 0ul, c2) + c1;
+    stream<value> c5 = delay(5, 0ul, c5) + c2;
+    stream<value> c10 = delay(10, 0ul, c10) + c5;
+    stream<value> c20 = delay(20, 0ul, c20) + c10;
+    stream<value> c50 = delay(50, 0ul, c50) + c20;
+    return last(c50, n);
+}
+
+// 0, 1, 2, ... through sixteen maps or zips in a row.
+const int depth = 16;
+
+struct inc
+{
+    value operator()(value x) const { return x+1; }
+};
+
+value map_chain(std::size_t n)
+{
+    stream<value> one = 1ul<<=one;
+    stream<value> nat = 0ul<<=nat+one;
+    std::vector<stream<value> > chain;
+    chain.reserve(depth);
+    chain.push_back(stream<value>::map(inc(), nat));
+    for(int i=1; i<depth; ++i)
+        chain.push_back(stream<value>::map(inc(), chain.back()));
+    return last(chain.back(), n);
+}
+
+value zip_chain(std::size_t n)
+{
+    stream<value> one = 1ul<<=one;
+    stream<value> nat = 0ul<<=nat+one;
+    std::vector<stream<value> > chain;
+    chain.reserve(depth);
+    chain.push_back(stream<value>::zipwith(std::plus<value>(), nat, one));
+    for(int i=1; i<depth; ++i)
+        chain.push_back(stream<value>::zipwith(std::plus<value>(), chain.back(), nat));
+    return last(chain.back(), n);
+}
+
+// Each element reaches a thousand elements back.
+value deep_delay(std::size_t n)
+{
+    stream<value> d = delay(1000, 1ul, d) + (0ul<<=d);
+    return last(d, n);
+}
+
+// Heavy values through four maps, read one at a time and in bulk.
+struct shift
+{
+    heavy operator()(const heavy &x) const
+    {
+        heavy y;
+        y.v.resize(x.v.size());
+        for(std::size_t i=0; i<x.v.size(); ++i)
+            y.v[i] = x.v[i]+1;
+        return y;
+    }
+};
+
+value heavy_map(std::size_t n)
+{
+    stream<heavy> h = heavy(0.)<<=stream<heavy>::map(shift(), h);
+    h.forget();
+    std::vector<stream<heavy> > chain;
+    chain.reserve(4);
+    chain.push_back(stream<heavy>::map(shift(), h));
+    for(int i=1; i<4; ++i)
+        chain.push_back(stream<heavy>::map(shift(), chain.back()));
+    for(stream<heavy> &s : chain)
+        s.forget();
+    stream<heavy>::iterator it = chain.back().begin();
+    for(std::size_t i=0; i<n; ++i) ++it;
+    return value((*it).v[0]);
+}
+
+value heavy_fill(std::size_t n)
+{
+    stream<heavy> h = heavy(0.)<<=stream<heavy>::map(shift(), h);
+    h.forget();
+    stream<heavy> s = stream<heavy>::map(shift(), stream<heavy>::map(shift(),
+        stream<heavy>::map(shift(), stream<heavy>::map(shift(), h))));
+    s.forget();
+    std::vector<heavy> out(256);
+    stream<heavy>::iterator it = s.begin();
+    for(std::size_t i=0; i<n; i+=out.size())
+        it.fill(&out[0], std::min(out.size(), n-i));
+    return value(out[0].v[0]);
+}
+
+int main(int argc, char *argv[])
+{
+    const int trials = argc > 1 ? std::atoi(argv[1]) : 11;
+    if(trials < 1) {
+        std::cerr<<"Usage: "<<argv[0]<<" [trials]"<<std::endl;
+        return 1;
+    }
+
+    perf_counters pc;
+    if(!pc.any())
+        std::cerr<<"No hardware counters, timing only"<<std::endl;
+
+    const std::size_t sizes[] = { 1000, 10000, 100000 };
+    std::vector<result> results;
+    for(std::size_t n : sizes) {
+        results.push_back(measure("fibonacci", n, trials, pc, fibonacci));
+        results.push_back(measure("fibonacci_forget", n, trials, pc, fibonacci_forget));
+        results.push_back(measure("change", n, trials, pc, change));
+        results.push_back(measure("map_chain", n, trials, pc, map_chain));
+        results.push_back(measure("zip_chain", n, trials, pc, zip_chain));
+        results.push_back(measure("deep_delay", n, trials, pc, deep_delay));
+        results.push_back(measure("heavy_map", n, trials, pc, heavy_map));
+        results.push_back(measure("heavy_fill", n, trials, pc, heavy_fill));
+    }
+
+    std::cout<<"{\n  \"unit\": \"ns/element\",\n  \"trials\": "<<trials
+        <<",\n  \"benchmarks\": [";
+    for(std::size_t i=0; i<results.size(); ++i) {
+        const result &r = results[i];
+        std::cout<<(i ? "," : "")<<"\n    { \"name\": \""<<r.name<<"\""
+            <<", \"size\": "<<r.size
+            <<", \"min\": "<<r.ns.front()
+            <<", \"p10\": "<<r.percentile(10)
+            <<", \"median\": "<<r.percentile(50)
+            <<", \"p90\": "<<r.percentile(90)
+            <<", \"max\": "<<r.ns.back()
+            <<", \"copies\": "<<r.copies
+            <<", \"moves\": "<<r.moves;
+        for(int e=0; e<perf_counters::events; ++e) {
+            std::cout<<", \""<<perf_counters::name(perf_counters::event(e))<<"\": ";
+            if(r.hw[e] < 0)
+                std::cout<<"null";
+            else
+                std::cout<<r.hw[e];
+        }
+#ifdef STREAM_STATS
+        std::cout<<", \"stats\": {";
+        for(int k=0; k<stream_stats::kinds; ++k) {
+            const stream_stats::counters &c = r.stats[k];
+            std::cout<<(k ? ", " : " ")<<"\""<<stream_stats::name(stream_stats::kind(k))<<"\": {"
+                <<" \"allocs\": "<<c.allocs<<", \"deletes\": "<<c.deletes
+                <<", \"gets\": "<<c.gets<<", \"nexts\": "<<c.nexts
+                <<", \"fills\": "<<c.fills<<", \"peak_bytes\": "<<c.peak_bytes<<" }";
+        }
+        std::cout<<" }";
+#endif
+        std::cout<<" }";
+    }
+    std::cout<<"\n  ]\n}"<<std::endl;
+    return 0;
+}
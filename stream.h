@@ -33,12 +33,47 @@
 #include <utility>
 #include <ctime>
 #include <cassert>
+#include <cstddef>
+#include <new>
+#include <vector>
+#include <array>
+#include <algorithm>
+#include <typeinfo>
+#include <functional>
+#include <map>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <set>
+#include <cstdlib>
+#include <cstdint>
+#include <cmath>
+#include <exception>
+#include <stdexcept>
 
 #if __GNUC__ > 4 || \
           (__GNUC__ == 4 && (__GNUC_MINOR__ >= 7))
 #define HAVE_LITERALS
 #endif
 
+#if (defined(__GNUC__) || defined(__clang__)) && \
+          (defined(__x86_64__) || defined(__i386__))
+#define HAVE_TARGET_DISPATCH
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+#define HAVE_MMAP
+#include <cerrno>
+#include <cstdio>
+#include <string>
+#include <system_error>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
 template<typename T>
 struct storage_type
 {
@@ -49,301 +84,6163 @@ struct storage_type
     >::type type;
 };
 
+/*
+ * Allocation policies for the nodes of a stream graph. Every evaluated
+ * element becomes a small node, so the default policy keeps a per-thread
+ * free list for each node size instead of going to the heap every time.
+ * A policy provides allocate(n) and deallocate(p, n); pick a different one
+ * for a value type by specializing stream_allocator.
+ */
+struct heap_allocator
+{
+    static void *allocate(std::size_t n)
+    {
+        return ::operator new(n);
+    }
+
+    static void deallocate(void *p, std::size_t)
+    {
+        ::operator delete(p);
+    }
+};
+
+/*
+ * Nodes of one size are carved out of aligned chunks of their own, so a
+ * node finds its chunk by masking its address. A chunk belongs to the
+ * pool of the thread that made it: that thread allocates from it, and
+ * takes back its freed nodes. Nodes freed on other threads are handed
+ * back through a lock-free list the owner empties as it allocates. A
+ * chunk with no node left in use goes back to the heap, except one spare
+ * per pool. When a thread exits, its pool is left to the next new thread,
+ * and meanwhile the threads freeing its nodes take them back in its place.
+ */
+struct pool_allocator
+{
+    static void *allocate(std::size_t n)
+    {
+        if(n > max_size)
+            return ::operator new(n);
+
+        pool &p = local();
+        if(p.remote_.load(std::memory_order_relaxed))
+            p.collect();
+        const std::size_t k = index(n);
+        chunk *c = p.current_[k];
+        if(!c || c->full())
+            c = p.refill(k);
+        return c->take();
+    }
+
+    static void deallocate(void *x, std::size_t n)
+    {
+        if(n > max_size) {
+            ::operator delete(x);
+            return;
+        }
+
+        chunk *c = chunk_of(x);
+        pool *p = c->owner_;
+        if(p == mine()) {
+            p->give(c, x);
+            if(p->remote_.load(std::memory_order_relaxed))
+                p->collect();
+        } else {
+            p->post(x);
+        }
+    }
+
+    // Chunks taken from the heap and not given back yet, of all threads.
+    static std::size_t chunks()
+    {
+        return count().load(std::memory_order_relaxed);
+    }
+
+private:
+    static const std::size_t granularity = 16;
+    static const std::size_t max_size = 256;
+    static const std::size_t classes = max_size/granularity;
+    static const std::size_t chunk_size = 64*1024;
+
+    struct node
+    {
+        node *next_;
+    };
+
+    struct pool;
+
+    struct chunk
+    {
+        pool *owner_;
+        void *raw_;
+        node *free_;
+        char *bump_;
+        std::size_t size_, live_;
+        bool listed_;
+
+        // Other chunks of the size with free nodes, when not current.
+        chunk *prev_, *next_;
+
+        bool full() const
+        {
+            return !free_ && bump_ + size_ > reinterpret_cast<const char*>(this) + chunk_size;
+        }
+
+        void *take()
+        {
+            ++live_;
+            if(free_) {
+                node *x = free_;
+                free_ = x->next_;
+                return x;
+            }
+            void *x = bump_;
+            bump_ += size_;
+            return x;
+        }
+
+        // Room for the nodes after the header.
+        void reset(std::size_t size)
+        {
+            free_ = 0;
+            bump_ = reinterpret_cast<char*>(this) + (sizeof(chunk)+63)/64*64;
+            size_ = size;
+            live_ = 0;
+            listed_ = false;
+            prev_ = next_ = 0;
+        }
+    };
+
+    struct pool
+    {
+        chunk *current_[classes];
+        chunk *partial_[classes];
+        chunk *spare_;
+        std::atomic<node*> remote_;
+
+        // Whether no thread owns the pool; changed under lock() only.
+        std::atomic<bool> orphan_;
+        pool *next_orphan_;
+
+        pool()
+            :spare_(0), remote_(0), orphan_(false), next_orphan_(0)
+        {
+            std::fill(current_, current_+classes, static_cast<chunk*>(0));
+            std::fill(partial_, partial_+classes, static_cast<chunk*>(0));
+        }
+
+        chunk *refill(std::size_t k)
+        {
+            chunk *c = partial_[k];
+            if(c) {
+                unlink(c);
+            } else {
+                c = spare_ ? spare_ : make();
+                spare_ = 0;
+                c->reset((k+1)*granularity);
+            }
+            current_[k] = c;
+            return c;
+        }
+
+        void give(chunk *c, void *x)
+        {
+            node *f = static_cast<node*>(x);
+            f->next_ = c->free_;
+            c->free_ = f;
+            --c->live_;
+            const std::size_t k = c->size_/granularity - 1;
+            if(c == current_[k])
+                return;
+            if(!c->live_)
+                release(c);
+            else if(!c->listed_)
+                link(c);
+        }
+
+        // Hands a node freed on another thread back.
+        void post(void *x)
+        {
+            node *f = static_cast<node*>(x);
+            f->next_ = remote_.load(std::memory_order_relaxed);
+            while(!remote_.compare_exchange_weak(f->next_, f))
+                ;
+            if(orphan_.load()) {
+                std::lock_guard<std::mutex> l(lock());
+                if(orphan_.load())
+                    collect();
+            }
+        }
+
+        void collect()
+        {
+            node *x = remote_.exchange(0);
+            while(x) {
+                node *y = x->next_;
+                give(chunk_of(x), x);
+                x = y;
+            }
+        }
+
+        // Called under lock() as the owner exits.
+        void leave()
+        {
+            orphan_.store(true);
+            collect();
+            for(std::size_t k=0; k<classes; ++k) {
+                chunk *c = current_[k];
+                current_[k] = 0;
+                if(c && !c->live_)
+                    release(c);
+                else if(c && !c->full())
+                    link(c);
+            }
+            if(spare_)
+                destroy(spare_);
+            spare_ = 0;
+        }
+
+    private:
+        void release(chunk *c)
+        {
+            if(c->listed_)
+                unlink(c);
+            if(spare_ || orphan_.load(std::memory_order_relaxed))
+                destroy(c);
+            else
+                spare_ = c;
+        }
+
+        void link(chunk *c)
+        {
+            chunk *&head = partial_[c->size_/granularity - 1];
+            c->prev_ = 0;
+            c->next_ = head;
+            if(head)
+                head->prev_ = c;
+            head = c;
+            c->listed_ = true;
+        }
+
+        void unlink(chunk *c)
+        {
+            chunk *&head = partial_[c->size_/granularity - 1];
+            if(c->prev_)
+                c->prev_->next_ = c->next_;
+            else
+                head = c->next_;
+            if(c->next_)
+                c->next_->prev_ = c->prev_;
+            c->prev_ = c->next_ = 0;
+            c->listed_ = false;
+        }
+
+        chunk *make()
+        {
+            // Twice the size, to cut an aligned chunk out of it.
+            void *raw = ::operator new(2*chunk_size);
+            const std::uintptr_t a = (reinterpret_cast<std::uintptr_t>(raw) + chunk_size-1) & ~std::uintptr_t(chunk_size-1);
+            chunk *c = reinterpret_cast<chunk*>(a);
+            c->owner_ = this;
+            c->raw_ = raw;
+            count().fetch_add(1, std::memory_order_relaxed);
+            return c;
+        }
+
+        static void destroy(chunk *c)
+        {
+            count().fetch_sub(1, std::memory_order_relaxed);
+            ::operator delete(c->raw_);
+        }
+    };
+
+    static chunk *chunk_of(void *x)
+    {
+        return reinterpret_cast<chunk*>(reinterpret_cast<std::uintptr_t>(x) & ~std::uintptr_t(chunk_size-1));
+    }
+
+    static std::size_t index(std::size_t n)
+    {
+        return (n+granularity-1)/granularity - 1;
+    }
+
+    static std::atomic<std::size_t> &count()
+    {
+        static std::atomic<std::size_t> n(0);
+        return n;
+    }
+
+    // Never destroyed, as nodes may still be freed during static
+    // destruction.
+    static std::mutex &lock()
+    {
+        static std::mutex *m = new std::mutex;
+        return *m;
+    }
+
+    static pool *&orphans()
+    {
+        static pool *p = 0;
+        return p;
+    }
+
+    static pool *&mine()
+    {
+        static thread_local pool *p = 0;
+        return p;
+    }
+
+    // Leaves the pool of the thread as it exits.
+    struct owner
+    {
+        ~owner()
+        {
+            std::lock_guard<std::mutex> l(lock());
+            pool *p = mine();
+            mine() = 0;
+            p->leave();
+            p->next_orphan_ = orphans();
+            orphans() = p;
+        }
+    };
+
+    static pool &local()
+    {
+        pool *&p = mine();
+        if(!p) {
+            {
+                std::lock_guard<std::mutex> l(lock());
+                p = orphans();
+                if(p) {
+                    orphans() = p->next_orphan_;
+                    p->orphan_.store(false);
+                } else {
+                    p = new pool;
+                }
+            }
+            static thread_local owner o;
+            (void)o;
+        }
+        return *p;
+    }
+};
+
 template<typename T>
-struct stream
+struct stream_allocator
 {
-protected:
-    struct impl;
+    typedef pool_allocator type;
+};
+
+// How a reader of stream<T>::async waits for its producer, and back.
+enum class async_wait { block, spin };
+
+/*
+ * Counters of what the nodes of each kind do, kept when STREAM_STATS is
+ * defined before including this header. Without it the hooks expand to
+ * nothing. Bytes are the sizes of the node objects themselves, not of
+ * the buffers they own. Copies of a stream show up as share nodes, the
+ * uses of a sub-stream computed once as cons nodes.
+ */
+#ifdef STREAM_STATS
+struct stream_stats
+{
+    enum kind { val, share, cons, add, delay, map, map2, zip, zip2, fuse,
+        expr, expr2, machine, async, scan, scan2, series, series2,
+        window, window2, mmap, kinds };
+
+    // What a kind's counters were at one time.
+    struct counters
+    {
+        unsigned long allocs, deletes, gets, nexts, fills;
+        std::size_t live_bytes, peak_bytes;
+    };
+
+    // The counters themselves, bumped from any thread. Every counter is a
+    // tally of its own, so nothing is ordered with them.
+    struct cell
+    {
+        std::atomic<unsigned long> allocs, deletes, gets, nexts, fills;
+        std::atomic<std::size_t> live_bytes, peak_bytes;
+    };
+
+    static counters of(kind k)
+    {
+        const cell &c = table()[k];
+        counters r;
+        r.allocs = c.allocs.load(std::memory_order_relaxed);
+        r.deletes = c.deletes.load(std::memory_order_relaxed);
+        r.gets = c.gets.load(std::memory_order_relaxed);
+        r.nexts = c.nexts.load(std::memory_order_relaxed);
+        r.fills = c.fills.load(std::memory_order_relaxed);
+        r.live_bytes = c.live_bytes.load(std::memory_order_relaxed);
+        r.peak_bytes = c.peak_bytes.load(std::memory_order_relaxed);
+        return r;
+    }
+
+    static const char *name(kind k)
+    {
+        static const char *const names[kinds] = {
+            "valimpl", "shareimpl", "consimpl", "addimpl", "delayimpl",
+            "mapimpl", "mapimpl2", "zipimpl", "zipimpl2", "fuseimpl",
+            "exprimpl", "exprimpl2", "machineimpl", "asyncimpl",
+            "scanimpl", "scanimpl2", "seriesimpl", "seriesimpl2",
+            "windowimpl", "windowimpl2", "mmapimpl"
+        };
+        return names[k];
+    }
+
+    static void reset()
+    {
+        for(int k=0; k<kinds; ++k) {
+            cell &c = table()[k];
+            c.allocs.store(0, std::memory_order_relaxed);
+            c.deletes.store(0, std::memory_order_relaxed);
+            c.gets.store(0, std::memory_order_relaxed);
+            c.nexts.store(0, std::memory_order_relaxed);
+            c.fills.store(0, std::memory_order_relaxed);
+            c.peak_bytes.store(c.live_bytes.load(std::memory_order_relaxed),
+                               std::memory_order_relaxed);
+        }
+    }
+
+    // One line per kind that did anything.
+    static void print(std::ostream &os)
+    {
+        for(int k=0; k<kinds; ++k) {
+            const counters c = of(kind(k));
+            if(!c.allocs && !c.deletes && !c.gets && !c.nexts && !c.fills)
+                continue;
+            os<<name(kind(k))<<": "<<c.allocs<<" new, "<<c.deletes<<" deleted, "
+                <<c.gets<<" get, "<<c.nexts<<" next, "<<c.fills<<" fill, "
+                <<c.live_bytes<<" bytes live, "<<c.peak_bytes<<" peak"<<std::endl;
+        }
+    }
+
+    static void allocated(kind k, std::size_t n)
+    {
+        cell &c = table()[k];
+        c.allocs.fetch_add(1, std::memory_order_relaxed);
+        const std::size_t live = c.live_bytes.fetch_add(n, std::memory_order_relaxed) + n;
+        std::size_t peak = c.peak_bytes.load(std::memory_order_relaxed);
+        while(peak < live &&
+              !c.peak_bytes.compare_exchange_weak(peak, live, std::memory_order_relaxed))
+            ;
+    }
+
+    static void deleted(kind k, std::size_t n)
+    {
+        cell &c = table()[k];
+        c.deletes.fetch_add(1, std::memory_order_relaxed);
+        c.live_bytes.fetch_sub(n, std::memory_order_relaxed);
+    }
+
+    static cell &at(kind k)
+    {
+        return table()[k];
+    }
+
+private:
+    static cell *table()
+    {
+        static cell t[kinds];
+        return t;
+    }
+};
+
+#define STREAM_STATS_NEW(k) stream_stats::allocated(stream_stats::k, sizeof(*this))
+#define STREAM_STATS_DELETE(k) stream_stats::deleted(stream_stats::k, sizeof(*this))
+#define STREAM_STATS_COUNT(k, c) \
+    (stream_stats::at(stream_stats::k).c.fetch_add(1, std::memory_order_relaxed))
+#else
+#define STREAM_STATS_NEW(k) ((void)0)
+#define STREAM_STATS_DELETE(k) ((void)0)
+#define STREAM_STATS_COUNT(k, c) ((void)0)
+#endif
+
+/*
+ * The loops a generator runs over a chunk of its inputs. Any functor gets
+ * the plain ones; specialize stream_kernel to give a functor a faster one.
+ * The plain loops also take inputs of other types than the result. They
+ * call the node's own op, so what a stateful op keeps carries over from
+ * one chunk to the next as it does from one element to the next.
+ */
+template<typename Op, typename T>
+struct scalar_kernel
+{
+    template<typename F, typename A>
+    static void apply(F &&op, const A *a, T *out, std::size_t n)
+    {
+        for(std::size_t i=0; i<n; ++i)
+            out[i] = op(a[i]);
+    }
+
+    template<typename F, typename A, typename B>
+    static void apply(F &&op, const A *a, const B *b, T *out, std::size_t n)
+    {
+        for(std::size_t i=0; i<n; ++i)
+            out[i] = op(a[i], b[i]);
+    }
+};
+
+/*
+ * For the standard arithmetic functors the loops are compiled a second
+ * time for AVX2, and the CPU decides on first use which one runs. The
+ * other one is the compiler's baseline vector code (SSE2 on x86-64), or
+ * scalar code where it has none.
+ */
+template<typename Op, typename T>
+struct simd_kernel
+{
+    typedef void unary(const T *, T *, std::size_t);
+    typedef void binary(const T *, const T *, T *, std::size_t);
+
+    static void apply(const Op &, const T *a, T *out, std::size_t n)
+    {
+        static unary *const f = pick<unary>(&loop, &loop_avx2);
+        f(a, out, n);
+    }
+
+    static void apply(const Op &, const T *a, const T *b, T *out, std::size_t n)
+    {
+        static binary *const f = pick<binary>(&loop, &loop_avx2);
+        f(a, b, out, n);
+    }
+
+private:
+    template<typename F>
+    static F *pick(F *base, F *avx2)
+    {
+#ifdef HAVE_TARGET_DISPATCH
+        __builtin_cpu_init();
+        if(__builtin_cpu_supports("avx2"))
+            return avx2;
+#else
+        (void)avx2;
+#endif
+        return base;
+    }
+
+    static void loop(const T *__restrict a, T *__restrict out, std::size_t n)
+    {
+        Op op;
+        for(std::size_t i=0; i<n; ++i)
+            out[i] = op(a[i]);
+    }
+
+    static void loop(const T *__restrict a, const T *__restrict b,
+                     T *__restrict out, std::size_t n)
+    {
+        Op op;
+        for(std::size_t i=0; i<n; ++i)
+            out[i] = op(a[i], b[i]);
+    }
+
+#ifdef HAVE_TARGET_DISPATCH
+    __attribute__((target("avx2")))
+#endif
+    static void loop_avx2(const T *__restrict a, T *__restrict out, std::size_t n)
+    {
+        Op op;
+        for(std::size_t i=0; i<n; ++i)
+            out[i] = op(a[i]);
+    }
+
+#ifdef HAVE_TARGET_DISPATCH
+    __attribute__((target("avx2")))
+#endif
+    static void loop_avx2(const T *__restrict a, const T *__restrict b,
+                          T *__restrict out, std::size_t n)
+    {
+        Op op;
+        for(std::size_t i=0; i<n; ++i)
+            out[i] = op(a[i], b[i]);
+    }
+};
+
+template<typename T>
+struct simd_type: std::integral_constant<bool,
+    std::is_same<T, int>::value || std::is_same<T, long>::value ||
+    std::is_same<T, float>::value || std::is_same<T, double>::value>
+{ };
+
+template<typename Op, typename T>
+struct simd_op: std::false_type { };
+
+template<typename T>
+struct simd_op<std::plus<T>, T>: simd_type<T> { };
+
+template<typename T>
+struct simd_op<std::minus<T>, T>: simd_type<T> { };
+
+template<typename T>
+struct simd_op<std::multiplies<T>, T>: simd_type<T> { };
+
+template<typename T>
+struct simd_op<std::divides<T>, T>: simd_type<T> { };
+
+template<typename T>
+struct simd_op<std::modulus<T>, T>: simd_type<T> { };
+
+template<typename T>
+struct simd_op<std::negate<T>, T>: simd_type<T> { };
+
+template<typename Op, typename T>
+struct stream_kernel: std::conditional<simd_op<Op, T>::value,
+    simd_kernel<Op, T>, scalar_kernel<Op, T> >::type
+{ };
+
+/*
+ * The threads parallel maps and zips run on, STREAM_THREADS of them or
+ * one less than the cores. Every worker has a queue of its own: it takes
+ * tasks from the back, and when it runs dry steals from the front of the
+ * others' queues. A thread that forked a task and waits for it runs
+ * tasks meanwhile, so nested forks never block a worker. Threads outside
+ * the pool share one more queue.
+ */
+class stream_pool
+{
+public:
+    static stream_pool &instance()
+    {
+        static stream_pool p;
+        return p;
+    }
+
+    std::size_t workers() const
+    {
+        return workers_.size();
+    }
+
+    // Runs a here and b wherever a thread is free; back when both are.
+    // If either throws, the first exception, a's before b's, is rethrown
+    // here once b is done or taken back unrun.
+    template<typename A, typename B>
+    void fork(A a, B b)
+    {
+        if(workers_.empty()) {
+            a();
+            b();
+            return;
+        }
+
+        task t(b);
+        push(&t);
+        try {
+            a();
+        } catch(...) {
+            if(!reclaim(&t))
+                join(&t);
+            throw;
+        }
+        join(&t);
+        if(t.error_)
+            std::rethrow_exception(t.error_);
+    }
+
+    // f(i, j) over [i, j) in halves down to pieces of at most grain.
+    template<typename F>
+    void split(std::size_t i, std::size_t j, std::size_t grain, const F &f)
+    {
+        if(j-i <= grain || workers_.empty()) {
+            f(i, j);
+            return;
+        }
+        const std::size_t h = i + (j-i)/2;
+        fork([&] { split(i, h, grain, f); },
+             [&] { split(h, j, grain, f); });
+    }
+
+private:
+    struct task
+    {
+        template<typename F>
+        explicit task(F f)
+            :f_(f), done_(false)
+        { }
+
+        std::function<void()> f_;
+        std::atomic<bool> done_;
+        std::exception_ptr error_;
+    };
+
+    struct queue
+    {
+        std::mutex mutex_;
+        std::deque<task*> tasks_;
+    };
+
+    stream_pool()
+        :pending_(0), stop_(false)
+    {
+        std::size_t n = std::thread::hardware_concurrency();
+        n = n > 1 ? n-1 : 0;
+        if(const char *e = std::getenv("STREAM_THREADS"))
+            n = std::strtoul(e, 0, 10);
+
+        for(std::size_t i=0; i<=n; ++i)
+            queues_.push_back(std::unique_ptr<queue>(new queue));
+        for(std::size_t i=1; i<=n; ++i)
+            workers_.push_back(std::thread(&stream_pool::work, this, i));
+    }
+
+    ~stream_pool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        cv_.notify_all();
+        for(std::thread &w : workers_)
+            w.join();
+    }
+
+    stream_pool(const stream_pool &);
+    stream_pool &operator=(const stream_pool &);
+
+    // The queue of this thread, 0 outside the pool.
+    static std::size_t &index()
+    {
+        static thread_local std::size_t i = 0;
+        return i;
+    }
+
+    queue &mine()
+    {
+        return *queues_[index()];
+    }
+
+    void push(task *t)
+    {
+        {
+            queue &q = mine();
+            std::lock_guard<std::mutex> lock(q.mutex_);
+            q.tasks_.push_back(t);
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            ++pending_;
+        }
+        cv_.notify_one();
+    }
+
+    task *pop(queue &q)
+    {
+        std::lock_guard<std::mutex> lock(q.mutex_);
+        if(q.tasks_.empty())
+            return 0;
+        task *t = q.tasks_.back();
+        q.tasks_.pop_back();
+        --pending_;
+        return t;
+    }
+
+    task *steal()
+    {
+        for(std::size_t k=1; k<=queues_.size(); ++k) {
+            queue &q = *queues_[(index()+k) % queues_.size()];
+            std::lock_guard<std::mutex> lock(q.mutex_);
+            if(q.tasks_.empty())
+                continue;
+            task *t = q.tasks_.front();
+            q.tasks_.pop_front();
+            --pending_;
+            return t;
+        }
+        return 0;
+    }
+
+    // Takes t back off this thread's queue if no one started it yet.
+    bool reclaim(task *t)
+    {
+        queue &q = mine();
+        std::lock_guard<std::mutex> lock(q.mutex_);
+        if(q.tasks_.empty() || q.tasks_.back() != t)
+            return false;
+        q.tasks_.pop_back();
+        --pending_;
+        return true;
+    }
+
+    // Runs other tasks until t is done.
+    void join(task *t)
+    {
+        while(!t->done_.load(std::memory_order_acquire)) {
+            task *x = pop(mine());
+            if(!x)
+                x = steal();
+            if(x)
+                run(x);
+            else
+                std::this_thread::yield();
+        }
+    }
+
+    static void run(task *t)
+    {
+        try {
+            t->f_();
+        } catch(...) {
+            t->error_ = std::current_exception();
+        }
+        t->done_.store(true, std::memory_order_release);
+    }
+
+    void work(std::size_t i)
+    {
+        index() = i;
+        for(;;) {
+            task *t = pop(mine());
+            if(!t)
+                t = steal();
+            if(t) {
+                run(t);
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock(mutex_);
+            cv_.wait(lock, [this] { return stop_ || pending_ > 0; });
+            if(stop_)
+                return;
+        }
+    }
+
+    std::vector<std::unique_ptr<queue> > queues_;
+    std::vector<std::thread> workers_;
+
+    // Tasks queued anywhere, for the workers to sleep on.
+    std::atomic<long> pending_;
+    bool stop_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+};
+
+/*
+ * The execution policy of map and zipwith that computes on the pool:
+ * stream<T>::zipwith(stream_par, op, s1, s2). The generator then works
+ * chunk elements at a time even for single reads, applies op to a chunk
+ * in pieces on several threads, and pulls the two operands of a zip at
+ * the same time when their definitions read no stream in common and not
+ * the zip itself. op must be safe to call concurrently. The elements are
+ * the same as without the policy.
+ */
+struct parallel_policy { };
+
+const parallel_policy stream_par = parallel_policy();
+
+template<typename Op>
+struct parallel_op
+{
+    explicit parallel_op(Op op)
+        :op_(op)
+    { }
+
+    template<typename... A>
+    auto operator()(A&&... a) const -> decltype(std::declval<const Op&>()(std::forward<A>(a)...))
+    {
+        return op_(std::forward<A>(a)...);
+    }
+
+    Op op_;
+};
+
+template<typename Op>
+struct is_parallel: std::false_type { };
+
+template<typename Op>
+struct is_parallel<parallel_op<Op> >: std::true_type { };
+
+// The loops for inputs of types A and B and results of type T. The
+// kernels specialized for a functor work on one type, so inputs of another
+// type get the plain loops, split on the pool for a parallel functor.
+template<typename Op, typename T, typename A = T, typename B = A>
+struct mixed_kernel: std::conditional<
+    (std::is_same<A, T>::value && std::is_same<B, T>::value) || is_parallel<Op>::value,
+    stream_kernel<Op, T>, scalar_kernel<Op, T> >::type
+{ };
+
+// Pieces of a chunk: a few per thread, for the stealing to even out.
+template<typename Op, typename T>
+struct stream_kernel<parallel_op<Op>, T>
+{
+    template<typename A>
+    static void apply(const parallel_op<Op> &op, const A *a, T *out, std::size_t n)
+    {
+        stream_pool &p = stream_pool::instance();
+        p.split(0, n, n/(4*p.workers()+1) + 1, [&](std::size_t i, std::size_t j) {
+            mixed_kernel<Op, T, A>::apply(op.op_, a+i, out+i, j-i);
+        });
+    }
+
+    template<typename A, typename B>
+    static void apply(const parallel_op<Op> &op, const A *a, const B *b, T *out, std::size_t n)
+    {
+        stream_pool &p = stream_pool::instance();
+        p.split(0, n, n/(4*p.workers()+1) + 1, [&](std::size_t i, std::size_t j) {
+            mixed_kernel<Op, T, A, B>::apply(op.op_, a+i, b+i, out+i, j-i);
+        });
+    }
+};
+
+/*
+ * Operators scan may regroup. Specialize stream_associative for an
+ * associative op to let scan sum long runs of elements on the pool.
+ * Integer sums, products and bitwise operators are declared here;
+ * floating point sums are not, since regrouping changes their rounding.
+ */
+template<typename Op, typename T>
+struct stream_associative: std::false_type { };
+
+template<typename T>
+struct stream_associative<std::plus<T>, T>: std::is_integral<T> { };
+
+template<typename T>
+struct stream_associative<std::multiplies<T>, T>: std::is_integral<T> { };
+
+template<typename T>
+struct stream_associative<std::bit_and<T>, T>: std::is_integral<T> { };
+
+template<typename T>
+struct stream_associative<std::bit_or<T>, T>: std::is_integral<T> { };
+
+template<typename T>
+struct stream_associative<std::bit_xor<T>, T>: std::is_integral<T> { };
+
+/*
+ * Operators whose results depend on their arguments alone. Equal maps and
+ * zips of a pure operator without state over the same streams are
+ * computed once within a definition; specialize stream_pure to let your
+ * own functors be compared. The arithmetic operators are declared here.
+ */
+template<typename Op>
+struct stream_pure: std::false_type { };
+
+template<typename T>
+struct stream_pure<std::plus<T> >: std::true_type { };
+
+template<typename T>
+struct stream_pure<std::minus<T> >: std::true_type { };
+
+template<typename T>
+struct stream_pure<std::multiplies<T> >: std::true_type { };
+
+template<typename T>
+struct stream_pure<std::divides<T> >: std::true_type { };
+
+template<typename T>
+struct stream_pure<std::modulus<T> >: std::true_type { };
+
+template<typename T>
+struct stream_pure<std::negate<T> >: std::true_type { };
+
+/*
+ * Exact products of blocks of integer power series, modulo 2^64 like the
+ * integer arithmetic itself. The coefficients are split into 32-bit
+ * halves and convolved by number theoretic transforms modulo three
+ * primes, whose product bounds the sums of up to max_length terms; the
+ * residues are put back together by Garner's rule.
+ */
+struct series_ntt
+{
+    typedef unsigned long long u64;
+    typedef unsigned int u32;
+
+    enum { max_length = 1<<20 };
+
+    static const u32 m0 = 998244353u, m1 = 167772161u, m2 = 469762049u;
+
+    // Adds the nx+ny-1 terms of x*y to out.
+    static void convolve(const u64 *x, std::size_t nx, const u64 *y, std::size_t ny, u64 *out)
+    {
+        assert(nx <= max_length && ny <= max_length);
+        std::size_t n = 1;
+        while(n < nx+ny-1)
+            n *= 2;
+
+        std::vector<u32> r[3][2];
+        residues<m0>(x, nx, y, ny, n, r[0]);
+        residues<m1>(x, nx, y, ny, n, r[1]);
+        residues<m2>(x, nx, y, ny, n, r[2]);
+
+        const u64 i01 = power<m1>(m0, m1-2);
+        const u64 i012 = power<m2>(u64(m0)*m1 % m2, m2-2);
+        for(std::size_t i=0; i<nx+ny-1; ++i) {
+            const u64 low = garner(r[0][0][i], r[1][0][i], r[2][0][i], i01, i012);
+            const u64 cross = garner(r[0][1][i], r[1][1][i], r[2][1][i], i01, i012);
+            out[i] += low + (cross << 32);
+        }
+    }
+
+private:
+    // The products of the low halves, and the sums of the products of a
+    // low and a high half, modulo M.
+    template<u32 M>
+    static void residues(const u64 *x, std::size_t nx, const u64 *y, std::size_t ny,
+                         std::size_t n, std::vector<u32> *r)
+    {
+        std::vector<u32> x0(n), x1(n), y0(n), y1(n);
+        for(std::size_t i=0; i<nx; ++i) {
+            x0[i] = u32(x[i]) % M;
+            x1[i] = u32(x[i] >> 32) % M;
+        }
+        for(std::size_t i=0; i<ny; ++i) {
+            y0[i] = u32(y[i]) % M;
+            y1[i] = u32(y[i] >> 32) % M;
+        }
+        transform<M>(x0, false);
+        transform<M>(x1, false);
+        transform<M>(y0, false);
+        transform<M>(y1, false);
+        for(std::size_t i=0; i<n; ++i) {
+            x1[i] = u32((u64(x0[i])*y1[i] + u64(x1[i])*y0[i] % M) % M);
+            x0[i] = u32(u64(x0[i])*y0[i] % M);
+        }
+        transform<M>(x0, true);
+        transform<M>(x1, true);
+        r[0].swap(x0);
+        r[1].swap(x1);
+    }
+
+    template<u32 M>
+    static u32 power(u64 b, u64 e)
+    {
+        u64 r = 1;
+        for(b %= M; e; e >>= 1, b = b*b % M)
+            if(e & 1)
+                r = r*b % M;
+        return u32(r);
+    }
+
+    // The value below m0 m1 m2 with these residues, modulo 2^64, given the
+    // inverses of m0 mod m1 and of m0 m1 mod m2.
+    static u64 garner(u64 r0, u64 r1, u64 r2, u64 i01, u64 i012)
+    {
+        const u64 t1 = (r1 + m1 - r0 % m1) % m1 * i01 % m1;
+        const u64 s = (r0 + u64(m0) % m2 * t1) % m2;
+        const u64 t2 = (r2 + m2 - s) % m2 * i012 % m2;
+        return r0 + u64(m0)*t1 + u64(m0)*m1*t2;
+    }
+
+    // In place, radix 2; 3 generates the multiplicative group of each prime.
+    template<u32 M>
+    static void transform(std::vector<u32> &a, bool inverse)
+    {
+        const std::size_t n = a.size();
+        for(std::size_t i=1, j=0; i<n; ++i) {
+            std::size_t bit = n >> 1;
+            for(; j & bit; bit >>= 1)
+                j ^= bit;
+            j ^= bit;
+            if(i < j)
+                std::swap(a[i], a[j]);
+        }
+
+        std::vector<u32> ws(n/2);
+        for(std::size_t len=2; len<=n; len*=2) {
+            u64 w = power<M>(3, (M-1)/len);
+            if(inverse)
+                w = power<M>(w, M-2);
+            ws[0] = 1;
+            for(std::size_t k=1; k<len/2; ++k)
+                ws[k] = u32(ws[k-1]*w % M);
+            for(std::size_t i=0; i<n; i+=len)
+                for(std::size_t k=0; k<len/2; ++k) {
+                    const u32 u = a[i+k];
+                    const u32 v = u32(u64(a[i+k+len/2])*ws[k] % M);
+                    a[i+k] = u+v >= M ? u+v-M : u+v;
+                    a[i+k+len/2] = u >= v ? u-v : u+M-v;
+                }
+        }
+
+        if(inverse) {
+            const u64 f = power<M>(n, M-2);
+            for(u32 &x : a)
+                x = u32(x*f % M);
+        }
+    }
+};
+
+template<typename T>
+struct stream;
+
+template<typename N>
+struct stream_expr;
+
+// The element type of a stream argument. Other types have none, so the
+// operators below leave them alone.
+template<typename S>
+struct stream_value_type_of
+{ };
+
+template<typename T>
+struct stream_value_type_of<stream<T> >
+{
+    typedef T type;
+};
+
+template<typename ST>
+struct stream_value_type: stream_value_type_of<typename std::decay<ST>::type>
+{ };
+
+// The element type of a map or zip: R, or if R is void, what op gives for
+// elements of types A.
+template<typename R, typename Op, typename... A>
+struct stream_result
+{
+    typedef R type;
+};
+
+template<typename Op, typename... A>
+struct stream_result<void, Op, A...>
+{
+    typedef typename std::decay<decltype(std::declval<Op&>()(std::declval<const A&>()...))>::type type;
+};
+
+// The expression node made of an operand of type X, as deduced by a
+// forwarding reference.
+template<typename X>
+struct stream_expr_node
+{ };
+
+template<typename X>
+struct is_stream_expr: std::false_type
+{ };
+
+template<typename X1, typename X2, typename = void>
+struct stream_expr_args
+{ };
+
+/*
+ * A lazy stream of Ts, each computed once and kept while anyone reads it.
+ * Elements are moved into their nodes, so a move-only T is fine for <<=,
+ * map and zipwith read element by element. What hands out copies (fill,
+ * delay, the machine, fusion and the bulk paths of map and zipwith)
+ * takes a copyable T, and buffering also a default constructible one.
+ */
+template<typename T>
+struct stream
+{
+protected:
+    struct impl;
+    struct machine;
+    struct term;
+
+    // Maps and zips read streams of other element types as well.
+    template<typename U>
+    friend struct stream;
+
+public:
+    typedef T value_type;
+
+    // Copies share the nodes and the elements evaluated so far.
+    stream(const stream<T> &o)
+        : impl_(share(o)), readers_(0), pending_(0), watch_(0)
+    {
+    }
+
+    stream(stream<T> &&o)
+        : impl_(0), readers_(0), pending_(0), watch_(0)
+    {
+        std::swap(impl_, o.impl_);
+    }
+
+    // An expression template becomes a single node here.
+    template<typename N>
+    stream(stream_expr<N> e)
+        : impl_(new exprimpl<N>(std::move(e.node_))), readers_(0), pending_(0), watch_(0)
+    {
+    }
+
+    stream<T> & operator = (stream<T> &&o)
+    {
+        if(this != &o)
+            std::swap(impl_, o.impl_);
+        return *this;
+    }
+
+    // A run of values goes one node at a time rather than down the
+    // stack, after the node at its end, whose iterators may stand on the
+    // streams inside the run.
+    ~stream()
+    {
+        watch_ = 0;
+        if(!impl_ || typeid(*impl_) != typeid(valimpl)) {
+            delete impl_;
+            return;
+        }
+
+        valimpl *x = static_cast<valimpl*>(impl_);
+        while(x->s_.impl_ && x->s_.impl_ != impl_ && typeid(*x->s_.impl_) == typeid(valimpl))
+            x = static_cast<valimpl*>(x->s_.impl_);
+        impl *end = x->s_.impl_;
+        x->s_.impl_ = 0;
+        if(end != impl_)
+            delete end;
+        while(impl_) {
+            x = static_cast<valimpl*>(impl_);
+            impl_ = x->s_.impl_;
+            x->s_.impl_ = 0;
+            delete x;
+        }
+    }
+
+    struct iterator {
+        iterator(const iterator &o)
+            :s_(o.s_)
+        {
+            ++s_->readers_;
+            s_->reach();
+        }
+
+        iterator(iterator &&o)
+            :s_(o.s_)
+        {
+            ++s_->readers_;
+        }
+
+        iterator &operator =(const iterator &o)
+        {
+            ++o.s_->readers_;
+            o.s_->reach();
+            leave();
+            s_ = o.s_;
+            return *this;
+        }
+
+        ~iterator()
+        {
+            leave();
+        }
+
+        iterator& operator ++()
+        {
+            s_->impl_->next(*this);
+            return *this;
+        }
+
+        const T& operator *() const
+        {
+            return s_->impl_->get(*this);
+        }
+
+        // Writes the current element and the n-1 after it to out and steps
+        // past them. The nodes hand over whole runs of elements per call;
+        // whatever a busy node leaves is read one element at a time.
+        // Move-only elements cannot be filled; they are read with *.
+        iterator &fill(T *out, std::size_t n)
+        {
+            static_assert(copies::value, "fill copies elements");
+            for(std::size_t m=take(out, n); m<n; ++m) {
+                out[m] = **this;
+                ++*this;
+            }
+            return *this;
+        }
+
+        // Steps past n elements. When nobody else is to read them, they
+        // are not kept, and maps and zips do not even compute them: their
+        // inputs move on, computing only what is needed further on.
+        iterator &advance(std::size_t n)
+        {
+            std::vector<T> scratch;
+            while(n) {
+                std::size_t m = 0;
+                if(s_->alone()) {
+                    m = s_->impl_->skip(*this, n);
+                    if(!m)
+                        m = waste(scratch, n, buffers());
+                }
+                if(!m) {
+                    ++*this;
+                    m = 1;
+                }
+                n -= m;
+            }
+            return *this;
+        }
+
+        friend struct stream<T>;
+
+    protected:
+        iterator(const stream<T> *s)
+            :s_(s)
+        {
+            ++s_->readers_;
+        }
+
+        // Drains up to a chunk of elements into scratch, if they can be
+        // buffered at all.
+        std::size_t waste(std::vector<T> &scratch, std::size_t n, std::true_type)
+        {
+            const std::size_t m = std::min<std::size_t>(n, chunk);
+            return s_->impl_->drain(*this, room(scratch, m), m);
+        }
+
+        std::size_t waste(std::vector<T> &, std::size_t, std::false_type)
+        {
+            return 0;
+        }
+
+        impl *&slot() const
+        {
+            return s_->impl_;
+        }
+
+        // Like fill, but stops early at an element that is still being
+        // computed further up in a recursion.
+        std::size_t take(T *out, std::size_t n)
+        {
+            const stream<T> *s = 0;
+            const impl *head = 0;
+            bool plain = false;
+            std::size_t i = 0, i0 = 0;
+            while(i < n) {
+                const bool val = s_->impl_->settled();
+                const std::size_t m = s_->alone() ?
+                    s_->impl_->drain(*this, out+i, n-i) :
+                    s_->impl_->fill(*this, out+i, n-i);
+                if(!m)
+                    break;
+                i += m;
+                plain = plain && val;
+                if(s_ == s && s_->impl_ == head && plain) {
+                    i = repeat(out, i0, i, n);
+                } else if(!s_->watch_ && (!s || !plain || s_ == s)) {
+                    s = s_;
+                    head = s_->impl_;
+                    plain = true;
+                    i0 = i;
+                }
+            }
+            return i;
+        }
+
+        // Back on the stream it stood on after i0 elements, with the same
+        // node at its head and only values in between, the iterator reads
+        // the same elements again: copies as many whole periods as fit
+        // before n.
+        static std::size_t repeat(T *out, std::size_t i0, std::size_t i, std::size_t n)
+        {
+            const std::size_t end = i + (n-i)/(i-i0)*(i-i0);
+            while(i < end) {
+                const std::size_t m = std::min(i-i0, end-i);
+                std::copy(out+i0, out+i0+m, out+i);
+                i += m;
+            }
+            return i;
+        }
+
+        // Like take, for the only reader the stream will ever have.
+        std::size_t drain(T *out, std::size_t n)
+        {
+            std::size_t i = 0;
+            while(i < n) {
+                const std::size_t m = s_->impl_->drain(*this, out+i, n-i);
+                if(!m)
+                    break;
+                i += m;
+            }
+            return i;
+        }
+
+        void move(const stream<T> &s)
+        {
+            ++s.readers_;
+            leave();
+            s_ = &s;
+        }
+
+        void leave()
+        {
+            if(--s_->readers_ == 0)
+                s_->left();
+        }
+
+        const stream<T> *s_;
+    };
+
+    iterator begin() const
+    {
+        reach();
+        return iterator(this);
+    }
+
+    /*
+     * Lets the stream drop the elements no iterator can reach any more, so
+     * a recursion with a fixed lookback runs in constant memory. The stream
+     * keeps everything still ahead of some iterator, including the ones
+     * its own definition reads it through; begin() afterwards starts at the
+     * oldest element kept. Streams defined on top of a forgotten stream
+     * should not be restarted. The copies of a stream read the same
+     * elements, so they forget with it.
+     */
+    void forget()
+    {
+        watch_ = this;
+        if(impl_ && typeid(*impl_) == typeid(shareimpl))
+            static_cast<shareimpl*>(impl_)->forget();
+    }
+
+    /*
+     * The elements of a stream for readers on several threads. They are
+     * computed once, under a lock, into segments of a fixed size, and each
+     * segment publishes how many of its elements are done, so iterators
+     * read whatever is done without locking. Each iterator keeps its own
+     * place. Like a stream, a memo keeps everything until forget(); after
+     * that a segment goes as soon as the last iterator left it. The memo
+     * reads an lvalue through a copy, and owns and forgets an rvalue.
+     * Iterators must go before the memo, and begin() and forget() must
+     * not race with each other.
+     */
+    class memo
+    {
+        struct segment
+        {
+            explicit segment(std::size_t n)
+                :vals_(n), ready_(0), next_(0), refs_(1)
+            { }
+
+            std::vector<T> vals_;
+            std::atomic<std::size_t> ready_;
+            std::atomic<segment*> next_;
+
+            // Iterators on it, and the link from the segment or memo
+            // before it.
+            std::atomic<int> refs_;
+        };
+
+        static void retain(segment *x)
+        {
+            x->refs_.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        // A segment going drops its link to the next one.
+        static void release(segment *x)
+        {
+            while(x && x->refs_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                segment *n = x->next_.load(std::memory_order_acquire);
+                delete x;
+                x = n;
+            }
+        }
+
+    public:
+        class iterator
+        {
+        public:
+            iterator(const iterator &o)
+                :m_(o.m_), x_(o.x_), i_(o.i_)
+            {
+                retain(x_);
+            }
+
+            iterator &operator=(const iterator &o)
+            {
+                retain(o.x_);
+                release(x_);
+                m_ = o.m_;
+                x_ = o.x_;
+                i_ = o.i_;
+                return *this;
+            }
+
+            ~iterator()
+            {
+                release(x_);
+            }
+
+            const T &operator *() const
+            {
+                if(x_->ready_.load(std::memory_order_acquire) <= i_)
+                    m_->produce(x_, i_);
+                return x_->vals_[i_];
+            }
+
+            iterator &operator ++()
+            {
+                if(++i_ == m_->size_)
+                    advance();
+                return *this;
+            }
+
+            iterator &fill(T *out, std::size_t n)
+            {
+                while(n) {
+                    const std::size_t m = std::min(n, m_->size_-i_);
+                    if(x_->ready_.load(std::memory_order_acquire) < i_+m)
+                        m_->produce(x_, i_+m-1);
+                    std::copy(&x_->vals_[i_], &x_->vals_[i_]+m, out);
+                    out += m;
+                    n -= m;
+                    i_ += m;
+                    if(i_ == m_->size_)
+                        advance();
+                }
+                return *this;
+            }
+
+            friend class memo;
+
+        private:
+            iterator(const memo *m, segment *x)
+                :m_(m), x_(x), i_(0)
+            {
+                retain(x_);
+            }
+
+            void advance()
+            {
+                segment *n = x_->next_.load(std::memory_order_acquire);
+                if(!n) {
+                    m_->produce(x_, i_-1);
+                    n = x_->next_.load(std::memory_order_acquire);
+                }
+                retain(n);
+                release(x_);
+                x_ = n;
+                i_ = 0;
+            }
+
+            const memo *m_;
+            segment *x_;
+            std::size_t i_;
+        };
+
+        explicit memo(const stream<T> &s, std::size_t segment_size = 1024)
+            :s_(s), it_(s_.begin()), size_(segment_size),
+            head_(new segment(size_)), tail_(head_)
+        {
+            assert(size_ > 0);
+            retain(tail_);
+        }
+
+        explicit memo(stream<T> &&s, std::size_t segment_size = 1024)
+            :s_(std::move(s)), it_(s_.begin()), size_(segment_size),
+            head_(new segment(size_)), tail_(head_)
+        {
+            assert(size_ > 0);
+            retain(tail_);
+            s_.forget();
+        }
+
+        ~memo()
+        {
+            release(head_);
+            release(tail_);
+        }
+
+        iterator begin() const
+        {
+            assert(head_);
+            return iterator(this, head_);
+        }
+
+        void forget()
+        {
+            release(head_);
+            head_ = 0;
+        }
+
+    private:
+        memo(const memo &);
+        memo &operator=(const memo &);
+
+        // Computes up to element i of x, which is the last segment or
+        // comes before it, in runs of chunk elements. Filling the last
+        // segment starts the one after it.
+        void produce(segment *x, std::size_t i) const
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            while(x->ready_.load(std::memory_order_relaxed) <= i) {
+                segment *t = tail_;
+                const std::size_t r = t->ready_.load(std::memory_order_relaxed);
+                const std::size_t m = std::min<std::size_t>(size_-r, chunk);
+                it_.fill(&t->vals_[r], m);
+                t->ready_.store(r+m, std::memory_order_release);
+                if(r+m < size_)
+                    continue;
+
+                segment *n = new segment(size_);
+                retain(n);
+                t->next_.store(n, std::memory_order_release);
+                tail_ = n;
+                release(t);
+            }
+        }
+
+        stream<T> s_;
+        mutable typename stream<T>::iterator it_;
+        const std::size_t size_;
+        segment *head_;
+        mutable segment *tail_;
+        mutable std::mutex mutex_;
+    };
+
+    /*
+     * Replaces the definition by a flat program computing the same
+     * elements: each stream object the definition reaches, including the
+     * ones it refers to by name, becomes a value in one array, and the
+     * ones read later through <<= or delay keep their last values in
+     * rings. A step runs the program once, in an order where every map or
+     * zip comes after its operands, instead of walking the node graph.
+     * A generator that has started stands for its operation as long as
+     * everything it gave out is still there. Parts the program cannot
+     * describe are read as they are. Other streams are not
+     * changed; this one keeps what it has evaluated so far. No iterator
+     * may stand on the stream itself.
+     */
+    void compile()
+    {
+        assert(!readers_);
+        machine *m = new machine(*this);
+        if(!m->ok()) {
+            delete m;
+            return;
+        }
+        impl_ = new machineimpl(m, impl_);
+    }
+
+    /*
+     * The stream from element n on. A definition that is a linear
+     * recurrence with constant coefficients, made of <<=, delay, +, -,
+     * unary - and products with constant streams such as pure(c), gets
+     * there by a matrix power in O(log n) steps; others are run n steps.
+     * A definition with parts that cannot be lowered, such as a forgotten
+     * stream that has dropped its first elements, is read through an
+     * iterator instead, as the program would read those parts ahead; it
+     * keeps none of what a forgetting stream passes. The result reads the
+     * nodes of this stream, which has to outlive it.
+     */
+    stream<T> seek(std::size_t n) const
+    {
+        machine *m = new machine(*this);
+        if(!m->ok() || m->reads()) {
+            delete m;
+            m = new machine(begin());
+        }
+        m->skip(n);
+        return stream<T>(new machineimpl(m, 0));
+    }
+
+    // Element n, reached as seek(n) does.
+    T at(std::size_t n) const
+    {
+        return *seek(n).begin();
+    }
+
+protected:
+
+    struct impl {
+        static void *operator new(std::size_t n)
+        {
+            return allocator::allocate(n);
+        }
+
+        static void operator delete(void *p, std::size_t n)
+        {
+            allocator::deallocate(p, n);
+        }
+
+        virtual ~impl() {}
+        virtual const T &get(const iterator &) = 0;
+        virtual void next(iterator &) = 0;
+
+        // Copies up to n elements to out and moves the iterator past them;
+        // returns 0 if the next element is not computable yet.
+        virtual std::size_t fill(iterator &it, T *out, std::size_t)
+        {
+            put(*out, get(it));
+            ++it;
+            return 1;
+        }
+
+        // Same as fill, but nobody else reads what it passes, so it need
+        // not be kept.
+        virtual std::size_t drain(iterator &it, T *out, std::size_t n)
+        {
+            return fill(it, out, n);
+        }
+
+        // Same as drain, without the elements: moves past up to n of them,
+        // computing no more than other nodes need. Nodes that cannot skip
+        // anything return 0.
+        virtual std::size_t skip(iterator &, std::size_t)
+        {
+            return 0;
+        }
+
+        // A reader standing before this node registers (d=1) or drops
+        // (d=-1) the streams it is going to enter from here.
+        virtual void reach(int) {}
+
+        // The readers to come of the stream that holds this node change
+        // by d.
+        virtual void wait(int) {}
+
+        // Describes the elements of s, which holds this node, to a machine.
+        // Nodes that cannot are read through an iterator instead.
+        virtual bool lower(machine &, const stream<T> &)
+        {
+            return false;
+        }
+
+        // Same as lower, for a generator with k of its results in front of
+        // it in s: one that started in s stands for its operation there,
+        // as the lazy node did, while s holds everything it gave out.
+        virtual bool resume(machine &, const stream<T> &, std::size_t)
+        {
+            return false;
+        }
+
+        // The stream this node owns as its rest, if any.
+        virtual const stream<T> *tail() { return 0; }
+
+        // Whether the node is a value that stays as it is: every read
+        // gives the same elements and ends on the same stream.
+        virtual bool settled() { return false; }
+
+        // Appends what makes this node equal to another one: the node type
+        // and the streams it reads. Nodes that cannot tell return false.
+        virtual bool signature(std::vector<const void*> &)
+        {
+            return false;
+        }
+
+        // Appends the operands of this type a lazy node owns, for the
+        // sub-streams under it to be compared.
+        virtual void owns(std::vector<const stream<T>*> &) {}
+
+        // Appends the streams this node reads, by name or its own.
+        // Nodes that cannot tell return false.
+        virtual bool operands(std::vector<const stream<T>*> &)
+        {
+            return false;
+        }
+
+        // Whether a starting map or zip that owns this lazy node may take
+        // its work over; fuse() then gives the node up as a term, leaving
+        // it to be deleted.
+        virtual bool fusible() { return false; }
+        virtual term *fuse() { return 0; }
+    };
+
+    typedef typename stream_allocator<T>::type allocator;
+
+    // Elements a generator asks from its inputs at once.
+    enum { chunk = 256 };
+
+    // Whether elements can be copied out of their nodes, as fill and
+    // take do. Move-only elements are made in their nodes and only read
+    // there, one at a time.
+    typedef std::is_copy_constructible<T> copies;
+
+    // Whether elements can sit in buffers made ahead of them, as the
+    // machine and fusion keep them.
+    typedef std::integral_constant<bool,
+        std::is_default_constructible<T>::value && copies::value> buffers;
+
+    mutable impl * impl_;
+
+    // Iterators standing on this stream and readers still to come.
+    mutable int readers_;
+    mutable int pending_;
+
+    // The forgetting stream whose first element owns this one; a stream
+    // that forgets watches itself.
+    mutable const stream<T> *watch_;
+
+    stream(impl *i)
+        :impl_(i), readers_(0), pending_(0), watch_(0)
+    { }
+
+    void reach() const
+    {
+        if(impl_)
+            impl_->reach(1);
+    }
+
+    void left() const
+    {
+        if(watch_)
+            watch_->trim();
+    }
+
+    // A forgetting stream with one reader and nobody to come keeps nothing
+    // of what the reader passes.
+    bool alone() const
+    {
+        return watch_ == this && readers_ == 1 && !pending_;
+    }
+
+    // Drops leading elements nobody stands on or is about to enter.
+    void trim() const
+    {
+        while(watch_ == this && !readers_ && !pending_ && impl_) {
+            const stream<T> *t = impl_->tail();
+            if(!t)
+                return;
+
+            if(t->readers_) {
+                t->watch_ = this;
+                return;
+            }
+
+            impl *x = t->impl_;
+            t->impl_ = 0;
+            delete impl_;
+            impl_ = x;
+        }
+    }
+
+    static void reach(const stream<T> &s, int d, std::true_type)
+    {
+        s.pending_ += d;
+        if(s.impl_)
+            s.impl_->wait(d);
+    }
+
+    static void reach(const stream<T> &s, int d, std::false_type)
+    {
+        if(s.impl_)
+            s.impl_->reach(d);
+    }
+
+    // An input owned by a generator has no other reader, so it forgets
+    // and the generator drains it instead of keeping its elements.
+    static void own(const stream<T> &, std::true_type)
+    {
+    }
+
+    static void own(const stream<T> &s, std::false_type)
+    {
+        s.watch_ = &s;
+    }
+
+    static std::size_t pull(iterator &it, T *out, std::size_t n, std::true_type)
+    {
+        return it.take(out, n);
+    }
+
+    static std::size_t pull(iterator &it, T *out, std::size_t n, std::false_type)
+    {
+        return it.drain(out, n);
+    }
+
+    // The first n elements of a scratch buffer, grown on first use, so
+    // that nodes read one element at a time construct none.
+    template<typename U>
+    static U *room(std::vector<U> &v, std::size_t n)
+    {
+        if(v.size() < n)
+            v.resize(n);
+        return &v[0];
+    }
+
+    // Copies an element out of its node. Only fill and take do, which
+    // the iterator does not offer for move-only elements.
+    static void put(T &out, const T &a)
+    {
+        put(out, a, copies());
+    }
+
+    static void put(T &out, const T &a, std::true_type)
+    {
+        out = a;
+    }
+
+    static void put(T &, const T &, std::false_type)
+    {
+        assert(!"move-only elements are not copied");
+    }
+
+    // An evaluated element in front of the node computing the rest.
+    struct valimpl: public impl {
+        valimpl(const T &a, impl *rest)
+            : a_(a), s_(rest)
+        {
+            STREAM_STATS_NEW(val);
+        }
+
+        // Takes a result over without copying it.
+        valimpl(T &&a, impl *rest)
+            : a_(std::move(a)), s_(rest)
+        {
+            STREAM_STATS_NEW(val);
+        }
+
+        ~valimpl()
+        {
+            STREAM_STATS_DELETE(val);
+        }
+
+        const T &get(const iterator &)
+        {
+            STREAM_STATS_COUNT(val, gets);
+            return a_;
+        }
+
+        void next(iterator &it)
+        {
+            STREAM_STATS_COUNT(val, nexts);
+            it.move(s_);
+        }
+
+        std::size_t fill(iterator &it, T *out, std::size_t n)
+        {
+            STREAM_STATS_COUNT(val, fills);
+            valimpl *x = this;
+            std::size_t i = 0;
+            for(;;) {
+                put(out[i++], x->a_);
+                impl *y = x->s_.impl_;
+                if(i == n || y == this || typeid(*y) != typeid(valimpl))
+                    break;
+                x = static_cast<valimpl*>(y);
+            }
+            it.move(x->s_);
+            return i;
+        }
+
+        // The only reader of a forgetting stream drops what it passes
+        // right away, as trim() would once it left. Stops before elements
+        // somebody stands on or is about to enter.
+        std::size_t skip(iterator &it, std::size_t n)
+        {
+            std::size_t i = 0;
+            while(i < n && typeid(*it.slot()) == typeid(valimpl)) {
+                valimpl *x = static_cast<valimpl*>(it.slot());
+                if(x->s_.readers_ || x->s_.pending_ || !x->s_.impl_ || x->s_.impl_ == x)
+                    break;
+                it.slot() = x->s_.impl_;
+                x->s_.impl_ = 0;
+                delete x;
+                ++i;
+            }
+            return i;
+        }
+
+        // The generator at the end of a run of values it made in s
+        // describes s if it can; otherwise the values are prefixes.
+        bool lower(machine &m, const stream<T> &s)
+        {
+            return lower(m, s, buffers());
+        }
+
+        bool lower(machine &, const stream<T> &, std::false_type)
+        {
+            return false;
+        }
+
+        bool lower(machine &m, const stream<T> &s, std::true_type)
+        {
+            if(!m.rest(s)) {
+                std::size_t k = 1;
+                impl *y = s_.impl_;
+                while(y && y != this && typeid(*y) == typeid(valimpl)) {
+                    y = static_cast<valimpl*>(y)->s_.impl_;
+                    ++k;
+                }
+                if(y && y != this && y->resume(m, s, k))
+                    return true;
+            }
+            m.value(s, a_, s_);
+            return true;
+        }
+
+        const stream<T> *tail()
+        {
+            return &s_;
+        }
+
+        bool settled()
+        {
+            return true;
+        }
+
+        bool operands(std::vector<const stream<T>*> &r)
+        {
+            r.push_back(&s_);
+            return true;
+        }
+
+        friend struct stream<T>;
+
+    private:
+        T a_;
+        stream<T> s_;
+    };
+
+    // The nodes copies of a stream read together.
+    struct shared
+    {
+        shared(impl *x)
+            :s_(x), refs_(0), name_(0)
+        { }
+
+        stream<T> s_;
+        int refs_;
+        // The stream the uses of a computed-once sub-stream go by.
+        const stream<T> *name_;
+    };
+
+    // A copy: reads go on in the shared stream, where everything
+    // evaluated through one copy is there for the others. Readers of the
+    // copy count as readers to come of the shared stream until they move
+    // over, so a shared stream that forgets keeps their first element.
+    struct shareimpl: public impl
+    {
+        // early readers already stand on the copy, registered with the
+        // nodes the shared stream starts with; waiting ones are still to
+        // come.
+        shareimpl(shared *p, int early, int waiting)
+            :p_(p), regs_(0), early_(early)
+        {
+            STREAM_STATS_NEW(share);
+            ++p_->refs_;
+            p_->s_.pending_ += early_ + waiting;
+        }
+
+        ~shareimpl()
+        {
+            STREAM_STATS_DELETE(share);
+            p_->s_.pending_ -= regs_ + early_;
+            if(--p_->refs_ == 0)
+                delete p_;
+        }
+
+        const T &get(const iterator &)
+        {
+            STREAM_STATS_COUNT(share, gets);
+            return *iterator(&p_->s_);
+        }
+
+        void next(iterator &it)
+        {
+            STREAM_STATS_COUNT(share, nexts);
+            enter(it);
+            ++it;
+        }
+
+        // Whatever the copy does, the shared elements are kept, so this
+        // is also the drain.
+        std::size_t fill(iterator &it, T *out, std::size_t n)
+        {
+            STREAM_STATS_COUNT(share, fills);
+            enter(it);
+            return p_->s_.impl_->fill(it, out, n);
+        }
+
+        void reach(int d)
+        {
+            regs_ += d;
+            p_->s_.pending_ += d;
+        }
+
+        void wait(int d)
+        {
+            p_->s_.pending_ += d;
+        }
+
+        void forget()
+        {
+            p_->s_.watch_ = &p_->s_;
+        }
+
+        bool lower(machine &m, const stream<T> &s)
+        {
+            return lower(m, s, buffers());
+        }
+
+        bool lower(machine &, const stream<T> &, std::false_type)
+        {
+            return false;
+        }
+
+        bool lower(machine &m, const stream<T> &s, std::true_type)
+        {
+            m.same(s, p_->s_);
+            return true;
+        }
+
+        bool operands(std::vector<const stream<T>*> &r)
+        {
+            r.push_back(&p_->s_);
+            return true;
+        }
+
+        friend struct stream<T>;
+
+    private:
+        // Moves a reader of the copy over to the shared stream.
+        void enter(iterator &it)
+        {
+            it.move(p_->s_);
+            if(early_) {
+                --early_;
+                --p_->s_.pending_;
+                return;
+            }
+            p_->s_.reach();
+            if(regs_) {
+                --regs_;
+                --p_->s_.pending_;
+            }
+        }
+
+        shared *p_;
+        int regs_, early_;
+    };
+
+    // The first copy of a stream moves its nodes to a shared stream; the
+    // original and every copy read that one from then on. Iterators on
+    // the original stand at the first element, which the shared stream
+    // starts with too. A stream that forgets hands that on.
+    static impl *share(const stream<T> &o)
+    {
+        if(!o.impl_)
+            return 0;
+        if(typeid(*o.impl_) != typeid(shareimpl)) {
+            shared *p = new shared(o.impl_);
+            o.impl_ = new shareimpl(p, o.readers_, o.pending_);
+            if(o.watch_ == &o)
+                p->s_.watch_ = &p->s_;
+        }
+        return new shareimpl(static_cast<shareimpl*>(o.impl_)->p_, 0, 0);
+    }
+
+    /*
+     * A sub-stream a definition spells out several times. The first use's
+     * nodes move to a shared stream that forgets, and every use reads it
+     * through an iterator of its own, so each element is computed once.
+     * A use that has not begun keeps the shared stream's start only while
+     * a reader is on its way to it, like any stream a reader is still to
+     * enter, so a use nobody reads holds nothing back.
+     */
+    struct consimpl: public impl
+    {
+        consimpl(shared *p)
+            :p_(p), it_(0), regs_(0)
+        {
+            STREAM_STATS_NEW(cons);
+            ++p_->refs_;
+        }
+
+        ~consimpl()
+        {
+            STREAM_STATS_DELETE(cons);
+            if(it_)
+                delete it_;
+            else
+                reach(-regs_);
+            if(--p_->refs_ == 0)
+                delete p_;
+        }
+
+        const T &get(const iterator &)
+        {
+            STREAM_STATS_COUNT(cons, gets);
+            return **start();
+        }
+
+        void next(iterator &)
+        {
+            STREAM_STATS_COUNT(cons, nexts);
+            ++*start();
+        }
+
+        std::size_t fill(iterator &, T *out, std::size_t n)
+        {
+            STREAM_STATS_COUNT(cons, fills);
+            return start()->take(out, n);
+        }
+
+        // The reader to come stands for one of the shared stream, and of
+        // whatever its nodes read while they are lazy.
+        void reach(int d)
+        {
+            regs_ += d;
+            p_->s_.pending_ += d;
+            stream<T>::reach(p_->s_, d, std::false_type());
+        }
+
+        bool lower(machine &m, const stream<T> &s)
+        {
+            return lower(m, s, buffers());
+        }
+
+        bool lower(machine &, const stream<T> &, std::false_type)
+        {
+            return false;
+        }
+
+        bool lower(machine &m, const stream<T> &s, std::true_type)
+        {
+            m.same(s, p_->s_);
+            return true;
+        }
+
+        bool operands(std::vector<const stream<T>*> &r)
+        {
+            r.push_back(&p_->s_);
+            return true;
+        }
+
+        friend struct stream<T>;
+
+    private:
+        iterator *start()
+        {
+            if(!it_) {
+                it_ = new iterator(p_->s_.begin());
+                reach(-regs_);
+            }
+            return it_;
+        }
+
+        shared *p_;
+        iterator *it_;
+        int regs_;
+    };
+
+    typedef std::vector<const void*> key;
+
+    // Names a stream read by a node for its signature. The uses of a
+    // shared stream go by the name of the first.
+    static const void *id(const stream<T> &s, std::true_type)
+    {
+        return &s;
+    }
+
+    static const void *id(const stream<T> &s, std::false_type)
+    {
+        if(s.impl_ && typeid(*s.impl_) == typeid(consimpl))
+            return static_cast<consimpl*>(s.impl_)->p_->name_;
+        return &s;
+    }
+
+    // What makes s equal to another stream: its lazy node's signature, or
+    // the shared stream's for a use of one.
+    static bool signature(const stream<T> &s, key &k)
+    {
+        const stream<T> *x = &s;
+        if(typeid(*s.impl_) == typeid(consimpl))
+            x = &static_cast<consimpl*>(s.impl_)->p_->s_;
+        return x->impl_ && x->impl_->signature(k);
+    }
+
+    // The streams under s, s included, that lazy nodes own, each after
+    // the ones it owns in turn. The nodes of a shared stream come under
+    // the first of its uses.
+    static std::vector<const stream<T>*> uses(const stream<T> &s)
+    {
+        std::vector<const stream<T>*> r, v;
+        std::vector<std::pair<const stream<T>*, bool> > todo(1, std::make_pair(&s, false));
+        std::set<const shared*> seen;
+        while(!todo.empty()) {
+            const stream<T> *x = todo.back().first;
+            const bool done = todo.back().second;
+            todo.pop_back();
+            if(done) {
+                r.push_back(x);
+                continue;
+            }
+            if(!x->impl_)
+                continue;
+            todo.push_back(std::make_pair(x, true));
+
+            const stream<T> *y = x;
+            if(typeid(*x->impl_) == typeid(consimpl)) {
+                const shared *p = static_cast<consimpl*>(x->impl_)->p_;
+                if(!seen.insert(p).second || !p->s_.impl_)
+                    continue;
+                y = &p->s_;
+            }
+            v.clear();
+            y->impl_->owns(v);
+            for(const stream<T> *z : v)
+                todo.push_back(std::make_pair(z, false));
+        }
+        return r;
+    }
+
+    /*
+     * The operands a node owns are parts of one definition: whatever b
+     * spells out the same way as a is computed once, read by both. The
+     * uses under b are compared after the ones they own, so that a node
+     * over merged streams compares equal as well. Named operands are
+     * definitions of their own and left alone.
+     */
+    static void cons(const stream<T> &a, const stream<T> &b, std::true_type)
+    {
+        std::map<key, const stream<T>*> first;
+        for(const stream<T> *x : uses(a)) {
+            key k;
+            if(signature(*x, k))
+                first.insert(std::make_pair(k, x));
+        }
+        if(first.empty())
+            return;
+
+        for(const stream<T> *y : uses(b)) {
+            key k;
+            if(!signature(*y, k))
+                continue;
+            typename std::map<key, const stream<T>*>::iterator i = first.find(k);
+            if(i == first.end())
+                continue;
+
+            const stream<T> &o = *i->second;
+            if(typeid(*o.impl_) != typeid(consimpl)) {
+                shared *p = new shared(o.impl_);
+                p->s_.watch_ = &p->s_;
+                p->name_ = &o;
+                o.impl_ = new consimpl(p);
+            }
+            impl *x = y->impl_;
+            y->impl_ = new consimpl(static_cast<consimpl*>(o.impl_)->p_);
+            delete x;
+        }
+    }
+
+    template<typename U, typename V>
+    static void cons(const stream<U> &, const stream<V> &, std::false_type)
+    {
+    }
+
+    // Appends s to the streams a node owns, unless it is named.
+    static void holds(std::vector<const stream<T>*> &r, const stream<T> &s, std::false_type)
+    {
+        r.push_back(&s);
+    }
+
+    template<typename U, typename B>
+    static void holds(std::vector<const stream<T>*> &, const stream<U> &, B)
+    {
+    }
+
+    // Every stream s reads, s included, into seen; false if some node on
+    // the way cannot tell.
+    static bool closure(const stream<T> &s, std::set<const stream<T>*> &seen)
+    {
+        std::vector<const stream<T>*> todo(1, &s);
+        while(!todo.empty()) {
+            const stream<T> *x = todo.back();
+            todo.pop_back();
+            if(!seen.insert(x).second || !x->impl_)
+                continue;
+            if(!x->impl_->operands(todo))
+                return false;
+        }
+        return true;
+    }
+
+    // Whether a and b can be computed on different threads: they read no
+    // stream in common, and not self, which is being computed from them.
+    static bool apart(const stream<T> &a, const stream<T> &b, const stream<T> *self)
+    {
+        std::set<const stream<T>*> x, y;
+        if(!closure(a, x) || !closure(b, y) || x.count(self) || y.count(self))
+            return false;
+        for(const stream<T> *p : x)
+            if(y.count(p))
+                return false;
+        return true;
+    }
+
+    // Streams of other types may read the same streams as well, unseen.
+    template<typename U, typename V>
+    static bool apart(const stream<U> &, const stream<V> &, const stream<T> *)
+    {
+        return false;
+    }
+
+    // Appends s to the operands of a node. A stream of another type cannot
+    // be listed, nor what it reads.
+    static bool reads(std::vector<const stream<T>*> &r, const stream<T> &s)
+    {
+        r.push_back(&s);
+        return true;
+    }
+
+    template<typename U>
+    static bool reads(std::vector<const stream<T>*> &, const stream<U> &)
+    {
+        return false;
+    }
+
+    template<typename ST>
+    struct addimpl: public impl {
+        typedef typename std::is_lvalue_reference<ST>::type by_ref;
+
+        addimpl(T a, ST &&s)
+            : a_(std::move(a)), s_(std::forward<ST>(s)), regs_(0)
+        {
+            STREAM_STATS_NEW(add);
+        }
+
+        ~addimpl()
+        {
+            STREAM_STATS_DELETE(add);
+        }
+
+        const T &get(const iterator &)
+        {
+            STREAM_STATS_COUNT(add, gets);
+            return a_;
+        }
+
+        void next(iterator &it)
+        {
+            STREAM_STATS_COUNT(add, nexts);
+            it.move(s_);
+            if(by_ref::value) {
+                s_.reach();
+                if(regs_) {
+                    --regs_;
+                    stream<T>::reach(s_, -1, by_ref());
+                }
+            }
+        }
+
+        std::size_t fill(iterator &it, T *out, std::size_t n)
+        {
+            STREAM_STATS_COUNT(add, fills);
+            addimpl *x = this;
+            std::size_t i = 0;
+            put(out[i++], a_);
+            while(!by_ref::value && i < n && x->tail()->impl_ &&
+                    typeid(*x->tail()->impl_) == typeid(addimpl)) {
+                x = static_cast<addimpl*>(x->tail()->impl_);
+                put(out[i++], x->a_);
+            }
+            x->next(it);
+            return i;
+        }
+
+        bool lower(machine &m, const stream<T> &s)
+        {
+            return lower(m, s, buffers());
+        }
+
+        bool lower(machine &, const stream<T> &, std::false_type)
+        {
+            return false;
+        }
+
+        bool lower(machine &m, const stream<T> &s, std::true_type)
+        {
+            m.prefix(s, 1, a_, s_);
+            return true;
+        }
+
+        void reach(int d)
+        {
+            if(by_ref::value)
+                regs_ += d;
+            stream<T>::reach(s_, d, by_ref());
+        }
+
+        const stream<T> *tail()
+        {
+            return by_ref::value ? 0 : &s_;
+        }
+
+        bool settled()
+        {
+            return true;
+        }
+
+        bool operands(std::vector<const stream<T>*> &r)
+        {
+            r.push_back(&s_);
+            return true;
+        }
+
+    private:
+        T a_;
+        typename storage_type<ST>::type s_;
+        int regs_;
+    };
+
+    template<typename Op, typename ST>
+    struct mapimpl2: public impl {
+        typedef typename std::is_lvalue_reference<ST>::type by_ref;
+        typedef stream<typename stream_value_type<ST>::type> input;
+
+        typedef is_parallel<Op> par;
+
+        // Whether the elements can be buffered, which takes a default and
+        // a copy constructor; if not, the node goes one element at a time.
+        typedef std::integral_constant<bool,
+            input::buffers::value && buffers::value> bulk;
+
+        // As in mapimpl.
+        typedef std::integral_constant<bool,
+            std::is_same<input, stream<T> >::value && buffers::value> same;
+
+        // self is the stream this node computes.
+        mapimpl2(Op op, ST &&s, const stream<T> *self)
+            :s_(std::forward<ST>(s)),
+            it1(s_.begin()), op_(op), self_(self), made_(0), busy_(false)
+        {
+            STREAM_STATS_NEW(map2);
+            input::own(s_, by_ref());
+        }
+
+        ~mapimpl2()
+        {
+            STREAM_STATS_DELETE(map2);
+        }
+
+        const T &get(const iterator &it)
+        {
+            STREAM_STATS_COUNT(map2, gets);
+            return step(it)->a_;
+        }
+
+        void next(iterator &it)
+        {
+            STREAM_STATS_COUNT(map2, nexts);
+            it.move(step(it)->s_);
+        }
+
+        std::size_t fill(iterator &it, T *out, std::size_t n)
+        {
+            STREAM_STATS_COUNT(map2, fills);
+            valimpl *x = 0;
+            const std::size_t m = run(it, out, n, &x);
+            if(m)
+                it.move(x->s_);
+            return m;
+        }
+
+        std::size_t drain(iterator &it, T *out, std::size_t n)
+        {
+            STREAM_STATS_COUNT(map2, fills);
+            return run(it, out, n, 0);
+        }
+
+        // Nobody reads the results, so op need not run.
+        std::size_t skip(iterator &, std::size_t n)
+        {
+            if(busy_)
+                return 0;
+            busy_ = true;
+            it1.advance(n);
+            made_ += n;
+            busy_ = false;
+            return n;
+        }
+
+        bool lower(machine &m, const stream<T> &s)
+        {
+            return resume(m, s, 0);
+        }
+
+        bool resume(machine &m, const stream<T> &s, std::size_t k)
+        {
+            return resume(m, s, k, same());
+        }
+
+        bool operands(std::vector<const stream<T>*> &r)
+        {
+            return reads(r, s_);
+        }
+    private:
+        bool resume(machine &, const stream<T> &, std::size_t, std::false_type)
+        {
+            return false;
+        }
+
+        bool resume(machine &m, const stream<T> &s, std::size_t k, std::true_type)
+        {
+            if(&s != self_ || (k != made_ && !m.owned(s)) || !m.whole(s_, by_ref()))
+                return false;
+            m.map(s, op_, s_);
+            return true;
+        }
+
+        valimpl *step(const iterator &it)
+        {
+            return step(it, std::integral_constant<bool, par::value && bulk::value>());
+        }
+
+        // In parallel, computes what the input has ready, up to a chunk.
+        valimpl *step(const iterator &it, std::true_type)
+        {
+            valimpl *x = 0;
+            run(it, room(out_, chunk), chunk, &x);
+            assert(x);
+            return static_cast<valimpl*>(it.slot());
+        }
+
+        valimpl *step(const iterator &it, std::false_type)
+        {
+            valimpl *x = new valimpl(op_(*it1), this);
+            ++it1;
+            ++made_;
+            it.slot() = x;
+            return x;
+        }
+
+        // Computes up to n elements, as many as the input has ready. Unless
+        // last is null, they are also kept in front of this node, with last
+        // pointed at the last one.
+        std::size_t run(const iterator &it, T *out, std::size_t n, valimpl **last)
+        {
+            return run(it, out, n, last, bulk());
+        }
+
+        std::size_t run(const iterator &it, T *out, std::size_t n, valimpl **last, std::false_type)
+        {
+            if(busy_)
+                return 0;
+
+            busy_ = true;
+            impl **slot = &it.slot();
+            for(std::size_t i=0; i<n; ++i) {
+                T x = op_(*it1);
+                ++it1;
+                if(out)
+                    put(out[i], x);
+                if(last) {
+                    *last = new valimpl(std::move(x), this);
+                    *slot = *last;
+                    slot = &(*last)->s_.impl_;
+                }
+            }
+            made_ += n;
+            busy_ = false;
+            return n;
+        }
+
+        std::size_t run(const iterator &it, T *out, std::size_t n, valimpl **last, std::true_type)
+        {
+            if(busy_)
+                return 0;
+
+            busy_ = true;
+            impl **slot = &it.slot();
+            std::size_t i = 0;
+            while(i < n) {
+                const std::size_t want = std::min<std::size_t>(n-i, chunk);
+                const std::size_t m = input::pull(it1, room(in_, want), want, by_ref());
+                if(!m)
+                    break;
+
+                if(out)
+                    mixed_kernel<Op, T, typename input::value_type>::apply(op_, &in_[0], out+i, m);
+                for(std::size_t j=0; last && j<m; ++j) {
+                    *last = out ? new valimpl(out[i+j], this) : new valimpl(op_(in_[j]), this);
+                    *slot = *last;
+                    slot = &(*last)->s_.impl_;
+                }
+                i += m;
+            }
+            made_ += i;
+            busy_ = false;
+            return i;
+        }
+
+        typename storage_type<ST>::type s_;
+        typename input::iterator it1;
+        Op op_;
+        std::vector<typename input::value_type> in_;
+        std::vector<T> out_;
+        const stream<T> *self_;
+        std::size_t made_;
+        bool busy_;
+    };
+
+    template<typename Op, typename ST>
+    struct mapimpl: public impl {
+        typedef typename std::is_lvalue_reference<ST>::type by_ref;
+        typedef stream<typename stream_value_type<ST>::type> input;
+
+        // Whether the operand is of this type, for the machine and fusion.
+        typedef std::integral_constant<bool,
+            std::is_same<input, stream<T> >::value && buffers::value> same;
+
+        mapimpl(Op op, ST &&s)
+            : s_(std::forward<ST>(s)), op_(op), regs_(0)
+        {
+            STREAM_STATS_NEW(map);
+        }
+
+        ~mapimpl()
+        {
+            STREAM_STATS_DELETE(map);
+        }
+
+        const T &get(const iterator &it)
+        {
+            STREAM_STATS_COUNT(map, gets);
+            start(it);
+            return *it;
+        }
+
+        void next(iterator &it)
+        {
+            STREAM_STATS_COUNT(map, nexts);
+            start(it);
+            ++it;
+        }
+
+        std::size_t fill(iterator &it, T *out, std::size_t n)
+        {
+            STREAM_STATS_COUNT(map, fills);
+            start(it);
+            return it.slot()->fill(it, out, n);
+        }
+
+        std::size_t drain(iterator &it, T *out, std::size_t n)
+        {
+            STREAM_STATS_COUNT(map, fills);
+            start(it);
+            return it.slot()->drain(it, out, n);
+        }
+
+        std::size_t skip(iterator &it, std::size_t n)
+        {
+            start(it);
+            return it.slot()->skip(it, n);
+        }
+
+        // Stands for the iterator the node starts when first evaluated.
+        void reach(int d)
+        {
+            regs_ += d;
+            input::reach(s_, d, by_ref());
+        }
+
+        bool lower(machine &m, const stream<T> &s)
+        {
+            return lower(m, s, same());
+        }
+
+        bool operands(std::vector<const stream<T>*> &r)
+        {
+            return reads(r, s_);
+        }
+
+        // A pure operation without state on the same stream is the same
+        // map.
+        bool signature(key &k)
+        {
+            if(!stream_pure<Op>::value || !std::is_empty<Op>::value)
+                return false;
+            k.push_back(&typeid(*this));
+            k.push_back(input::id(s_, by_ref()));
+            return true;
+        }
+
+        void owns(std::vector<const stream<T>*> &r)
+        {
+            holds(r, s_, by_ref());
+        }
+
+        bool fusible()
+        {
+            return same::value && !is_parallel<Op>::value;
+        }
+
+        term *fuse()
+        {
+            return fuse(same());
+        }
+
+        // Whether to start fused: the operand is a lazy map or zip of its own.
+        bool folds()
+        {
+            return fusible() && input::fuses(s_, by_ref());
+        }
+
+    private:
+        bool lower(machine &, const stream<T> &, std::false_type)
+        {
+            return false;
+        }
+
+        bool lower(machine &m, const stream<T> &s, std::true_type)
+        {
+            m.map(s, op_, s_);
+            return true;
+        }
+
+        term *fuse(std::false_type)
+        {
+            return 0;
+        }
+
+        term *fuse(std::true_type)
+        {
+            return new mapterm<Op>(op_, make_term(std::forward<ST>(s_)));
+        }
+
+        void start(const iterator &it)
+        {
+            reach(-regs_);
+            it.slot() = 0;
+            impl *x;
+            if(folds())
+                x = fused(fuse(), it.s_, buffers());
+            else
+                x = new mapimpl2<Op, ST>(op_, std::forward<ST>(s_), it.s_);
+            it.slot() = x;
+            delete this;
+        }
+
+        typename storage_type<ST>::type s_;
+        Op op_;
+        int regs_;
+    };
+
+    template<typename Op, typename ST1, typename ST2>
+    struct zipimpl: public impl
+    {
+        typedef typename std::is_lvalue_reference<ST1>::type by_ref1;
+        typedef typename std::is_lvalue_reference<ST2>::type by_ref2;
+        typedef stream<typename stream_value_type<ST1>::type> input1;
+        typedef stream<typename stream_value_type<ST2>::type> input2;
+
+        typedef std::integral_constant<bool,
+            std::is_same<input1, stream<T> >::value &&
+            std::is_same<input2, stream<T> >::value && buffers::value> same;
+
+        // Whether both operands are its own to compare, of one type.
+        typedef std::integral_constant<bool, !by_ref1::value && !by_ref2::value &&
+            std::is_same<input1, input2>::value> owned;
+
+        zipimpl(Op op, ST1 &&s1, ST2 &&s2)
+            :s1_(std::forward<ST1>(s1)), s2_(std::forward<ST2>(s2)), op_(op),
+            regs_(0)
+        {
+            STREAM_STATS_NEW(zip);
+            input1::cons(s1_, s2_, owned());
+        }
+
+        ~zipimpl()
+        {
+            STREAM_STATS_DELETE(zip);
+        }
+
+        const T &get(const iterator &it)
+        {
+            STREAM_STATS_COUNT(zip, gets);
+            start(it);
+            return *it;
+        }
+
+        void next(iterator &it)
+        {
+            STREAM_STATS_COUNT(zip, nexts);
+            start(it);
+            ++it;
+        }
+
+        std::size_t fill(iterator &it, T *out, std::size_t n)
+        {
+            STREAM_STATS_COUNT(zip, fills);
+            start(it);
+            return it.slot()->fill(it, out, n);
+        }
+
+        std::size_t drain(iterator &it, T *out, std::size_t n)
+        {
+            STREAM_STATS_COUNT(zip, fills);
+            start(it);
+            return it.slot()->drain(it, out, n);
+        }
+
+        std::size_t skip(iterator &it, std::size_t n)
+        {
+            start(it);
+            return it.slot()->skip(it, n);
+        }
+
+        void reach(int d)
+        {
+            regs_ += d;
+            input1::reach(s1_, d, by_ref1());
+            input2::reach(s2_, d, by_ref2());
+        }
+
+        bool lower(machine &m, const stream<T> &s)
+        {
+            return lower(m, s, same());
+        }
+
+        bool operands(std::vector<const stream<T>*> &r)
+        {
+            return reads(r, s1_) && reads(r, s2_);
+        }
+
+        bool signature(key &k)
+        {
+            if(!stream_pure<Op>::value || !std::is_empty<Op>::value)
+                return false;
+            k.push_back(&typeid(*this));
+            k.push_back(input1::id(s1_, by_ref1()));
+            k.push_back(input2::id(s2_, by_ref2()));
+            return true;
+        }
+
+        void owns(std::vector<const stream<T>*> &r)
+        {
+            holds(r, s1_, by_ref1());
+            holds(r, s2_, by_ref2());
+        }
+
+        bool fusible()
+        {
+            return same::value && !is_parallel<Op>::value;
+        }
+
+        term *fuse()
+        {
+            return fuse(same());
+        }
+
+        bool folds()
+        {
+            return fusible() && (input1::fuses(s1_, by_ref1()) || input2::fuses(s2_, by_ref2()));
+        }
+
+    private:
+        bool lower(machine &, const stream<T> &, std::false_type)
+        {
+            return false;
+        }
+
+        bool lower(machine &m, const stream<T> &s, std::true_type)
+        {
+            m.zip(s, op_, s1_, s2_);
+            return true;
+        }
+
+        term *fuse(std::false_type)
+        {
+            return 0;
+        }
+
+        term *fuse(std::true_type)
+        {
+            term *a = make_term(std::forward<ST1>(s1_));
+            return new zipterm<Op>(op_, a, make_term(std::forward<ST2>(s2_)));
+        }
+
+        void start(const iterator &it)
+        {
+            reach(-regs_);
+            it.slot() = 0;
+            impl *x;
+            if(folds())
+                x = fused(fuse(), it.s_, buffers());
+            else
+                x = new zipimpl2<Op, ST1, ST2>(op_, std::forward<ST1>(s1_), std::forward<ST2>(s2_), it.s_);
+            it.slot() = x;
+            delete this;
+        }
+
+        typename storage_type<ST1>::type s1_;
+        typename storage_type<ST2>::type s2_;
+        Op op_;
+        int regs_;
+    };
+
+    template<typename Op, typename ST1, typename ST2>
+    struct zipimpl2: public impl
+    {
+        typedef typename std::is_lvalue_reference<ST1>::type by_ref1;
+        typedef typename std::is_lvalue_reference<ST2>::type by_ref2;
+        typedef stream<typename stream_value_type<ST1>::type> input1;
+        typedef stream<typename stream_value_type<ST2>::type> input2;
+
+        typedef is_parallel<Op> par;
+
+        // As in mapimpl2.
+        typedef std::integral_constant<bool,
+            input1::buffers::value && input2::buffers::value &&
+            buffers::value> bulk;
+
+        typedef std::integral_constant<bool,
+            std::is_same<input1, stream<T> >::value &&
+            std::is_same<input2, stream<T> >::value && buffers::value> same;
+
+        // self is the stream this node computes.
+        zipimpl2(Op op, ST1 &&s1, ST2 &&s2, const stream<T> *self)
+            :s1_(std::forward<ST1>(s1)),s2_(std::forward<ST2>(s2)),
+            it1(s1_.begin()), it2(s2_.begin()), op_(op),
+            n1_(0), n2_(0), self_(self), made_(0), busy_(false),
+            apart_(par::value && apart(s1_, s2_, self))
+        {
+            STREAM_STATS_NEW(zip2);
+            input1::own(s1_, by_ref1());
+            input2::own(s2_, by_ref2());
+        }
+
+        ~zipimpl2()
+        {
+            STREAM_STATS_DELETE(zip2);
+        }
+
+        const T &get(const iterator &it)
+        {
+            STREAM_STATS_COUNT(zip2, gets);
+            return step(it)->a_;
+        }
+
+        void next(iterator &it)
+        {
+            STREAM_STATS_COUNT(zip2, nexts);
+            it.move(step(it)->s_);
+        }
+
+        std::size_t fill(iterator &it, T *out, std::size_t n)
+        {
+            STREAM_STATS_COUNT(zip2, fills);
+            valimpl *x = 0;
+            const std::size_t m = run(it, out, n, &x);
+            if(m)
+                it.move(x->s_);
+            return m;
+        }
+
+        std::size_t drain(iterator &it, T *out, std::size_t n)
+        {
+            STREAM_STATS_COUNT(zip2, fills);
+            return run(it, out, n, 0);
+        }
+
+        // As in mapimpl2, past what waits in the buffers first.
+        std::size_t skip(iterator &, std::size_t n)
+        {
+            if(busy_)
+                return 0;
+            busy_ = true;
+            const std::size_t k1 = std::min(n, n1_), k2 = std::min(n, n2_);
+            std::move(in1_.begin()+k1, in1_.begin()+n1_, in1_.begin());
+            std::move(in2_.begin()+k2, in2_.begin()+n2_, in2_.begin());
+            n1_ -= k1;
+            n2_ -= k2;
+            it1.advance(n-k1);
+            it2.advance(n-k2);
+            made_ += n;
+            busy_ = false;
+            return n;
+        }
+
+        bool lower(machine &m, const stream<T> &s)
+        {
+            return resume(m, s, 0);
+        }
+
+        // As in mapimpl2.
+        bool resume(machine &m, const stream<T> &s, std::size_t k)
+        {
+            return resume(m, s, k, same());
+        }
+
+        bool operands(std::vector<const stream<T>*> &r)
+        {
+            return reads(r, s1_) && reads(r, s2_);
+        }
+    private:
+        bool resume(machine &, const stream<T> &, std::size_t, std::false_type)
+        {
+            return false;
+        }
+
+        bool resume(machine &m, const stream<T> &s, std::size_t k, std::true_type)
+        {
+            if(&s != self_ || (k != made_ && !m.owned(s)))
+                return false;
+            if(!m.whole(s1_, by_ref1()) || !m.whole(s2_, by_ref2()))
+                return false;
+            m.zip(s, op_, s1_, s2_);
+            return true;
+        }
+
+        valimpl *step(const iterator &it)
+        {
+            return step(it, std::integral_constant<bool, par::value && bulk::value>());
+        }
+
+        valimpl *step(const iterator &it, std::true_type)
+        {
+            valimpl *x = 0;
+            run(it, room(out_, chunk), chunk, &x);
+            assert(x);
+            return static_cast<valimpl*>(it.slot());
+        }
+
+        valimpl *step(const iterator &it, std::false_type)
+        {
+            valimpl *x = 0;
+            if(n1_ || n2_) {
+                run(it, 0, 1, &x);
+            } else {
+                x = new valimpl(op_(*it1, *it2), this);
+                ++it1;
+                ++it2;
+                ++made_;
+                it.slot() = x;
+            }
+            assert(x);
+            return x;
+        }
+
+        // As in mapimpl2. The two inputs may have a different number of
+        // elements ready; what one of them gave in excess waits in its
+        // buffer.
+        std::size_t run(const iterator &it, T *out, std::size_t n, valimpl **last)
+        {
+            return run(it, out, n, last, bulk());
+        }
+
+        std::size_t run(const iterator &it, T *out, std::size_t n, valimpl **last, std::false_type)
+        {
+            if(busy_)
+                return 0;
+
+            busy_ = true;
+            impl **slot = &it.slot();
+            for(std::size_t i=0; i<n; ++i) {
+                T x = op_(*it1, *it2);
+                ++it1;
+                ++it2;
+                if(out)
+                    put(out[i], x);
+                if(last) {
+                    *last = new valimpl(std::move(x), this);
+                    *slot = *last;
+                    slot = &(*last)->s_.impl_;
+                }
+            }
+            made_ += n;
+            busy_ = false;
+            return n;
+        }
+
+        std::size_t run(const iterator &it, T *out, std::size_t n, valimpl **last, std::true_type)
+        {
+            if(busy_)
+                return 0;
+
+            busy_ = true;
+            impl **slot = &it.slot();
+            std::size_t i = 0;
+            while(i < n) {
+                const std::size_t want = std::min<std::size_t>(n-i, chunk);
+                room(in1_, want);
+                room(in2_, want);
+                if(apart_ && n1_ < want && n2_ < want) {
+                    std::size_t m1 = 0, m2 = 0;
+                    stream_pool::instance().fork(
+                        [&] { m1 = input1::pull(it1, &in1_[n1_], want-n1_, by_ref1()); },
+                        [&] { m2 = input2::pull(it2, &in2_[n2_], want-n2_, by_ref2()); });
+                    n1_ += m1;
+                    n2_ += m2;
+                }
+                if(n1_ < want)
+                    n1_ += input1::pull(it1, &in1_[n1_], want-n1_, by_ref1());
+                if(n2_ < want)
+                    n2_ += input2::pull(it2, &in2_[n2_], want-n2_, by_ref2());
+
+                const std::size_t m = std::min(want, std::min(n1_, n2_));
+                if(!m)
+                    break;
+
+                if(out)
+                    mixed_kernel<Op, T, typename input1::value_type, typename input2::value_type>::apply(op_, &in1_[0], &in2_[0], out+i, m);
+                for(std::size_t j=0; last && j<m; ++j) {
+                    *last = out ? new valimpl(out[i+j], this) :
+                        new valimpl(op_(in1_[j], in2_[j]), this);
+                    *slot = *last;
+                    slot = &(*last)->s_.impl_;
+                }
+                std::move(in1_.begin()+m, in1_.begin()+n1_, in1_.begin());
+                std::move(in2_.begin()+m, in2_.begin()+n2_, in2_.begin());
+                n1_ -= m;
+                n2_ -= m;
+                i += m;
+            }
+            made_ += i;
+            busy_ = false;
+            return i;
+        }
+
+        typename storage_type<ST1>::type s1_;
+        typename storage_type<ST2>::type s2_;
+        typename input1::iterator it1;
+        typename input2::iterator it2;
+        Op op_;
+        std::vector<typename input1::value_type> in1_;
+        std::vector<typename input2::value_type> in2_;
+        std::vector<T> out_;
+        std::size_t n1_, n2_;
+        const stream<T> *self_;
+        std::size_t made_;
+        bool busy_;
+
+        // The operands may be pulled on two threads at once.
+        const bool apart_;
+    };
+
+    /*
+     * Fusion. A map or zip that starts on lazy maps and zips it owns,
+     * which nobody else can read, takes their operations over: the
+     * expression runs as one node over a tree of terms, computed a chunk
+     * at a time from the streams at its leaves, so each element costs one
+     * node step instead of one per level. Until then the nodes stay apart,
+     * to be shared with equal ones and compiled.
+     */
+    struct leaf;
+
+    struct term
+    {
+        virtual ~term() {}
+
+        // The next m elements, from the first m buffered at each leaf.
+        virtual T *eval(std::size_t m) = 0;
+
+        // The next element alone, without the kernels.
+        virtual T first() = 0;
+
+        virtual void leaves(std::vector<leaf*> &r) = 0;
+
+        // The signal of the elements, once every leaf is whole().
+        virtual std::size_t lower(machine &m) = 0;
+    };
+
+    // A stream read by a fused node, pulled ahead into a buffer.
+    struct leaf: public term
+    {
+        leaf()
+            :n_(0)
+        { }
+
+        T *eval(std::size_t)
+        {
+            return &in_[0];
+        }
+
+        void leaves(std::vector<leaf*> &r)
+        {
+            r.push_back(this);
+        }
+
+        // Opens an iterator when the node starts.
+        virtual void start() = 0;
+
+        // Buffers up to n elements, as many as the stream has ready.
+        virtual std::size_t ahead(std::size_t n) = 0;
+
+        // Moves past the element first() gave, buffered or not.
+        virtual void next() = 0;
+
+        // Moves past n elements, the buffered ones first.
+        virtual void skip(std::size_t n) = 0;
+
+        virtual void reach(int d) = 0;
+        virtual const stream<T> &operand() const = 0;
+
+        // As machine::whole for the stream read.
+        virtual bool whole(machine &m) = 0;
+
+        void drop(std::size_t m)
+        {
+            std::move(in_.begin()+m, in_.begin()+n_, in_.begin());
+            n_ -= m;
+        }
+
+    protected:
+        std::vector<T> in_;
+        std::size_t n_;
+    };
+
+    template<typename ST>
+    struct leafterm: public leaf
+    {
+        typedef typename std::is_lvalue_reference<ST>::type by_ref;
+
+        leafterm(ST &&s)
+            :s_(std::forward<ST>(s)), it_(0)
+        { }
+
+        ~leafterm()
+        {
+            delete it_;
+        }
+
+        void start()
+        {
+            own(s_, by_ref());
+            it_ = new iterator(s_.begin());
+        }
+
+        std::size_t ahead(std::size_t n)
+        {
+            if(this->n_ < n)
+                this->n_ += pull(*it_, room(this->in_, n)+this->n_, n-this->n_, by_ref());
+            return this->n_;
+        }
+
+        T first()
+        {
+            return this->n_ ? this->in_[0] : **it_;
+        }
+
+        void next()
+        {
+            if(this->n_)
+                this->drop(1);
+            else
+                ++*it_;
+        }
+
+        void skip(std::size_t n)
+        {
+            const std::size_t k = std::min(n, this->n_);
+            this->drop(k);
+            it_->advance(n-k);
+        }
+
+        void reach(int d)
+        {
+            stream<T>::reach(s_, d, by_ref());
+        }
+
+        const stream<T> &operand() const
+        {
+            return s_;
+        }
+
+        bool whole(machine &m)
+        {
+            return m.whole(s_, by_ref());
+        }
+
+        std::size_t lower(machine &m)
+        {
+            return m.signal(s_);
+        }
+
+    private:
+        typename storage_type<ST>::type s_;
+        iterator *it_;
+    };
+
+    template<typename Op>
+    struct mapterm: public term
+    {
+        mapterm(Op op, term *a)
+            :op_(op), a_(a)
+        { }
+
+        ~mapterm()
+        {
+            delete a_;
+        }
+
+        T *eval(std::size_t m)
+        {
+            T *out = room(out_, m);
+            stream_kernel<Op, T>::apply(op_, a_->eval(m), out, m);
+            return out;
+        }
+
+        T first()
+        {
+            return op_(a_->first());
+        }
+
+        void leaves(std::vector<leaf*> &r)
+        {
+            a_->leaves(r);
+        }
+
+        std::size_t lower(machine &m)
+        {
+            return m.map(op_, a_->lower(m));
+        }
+
+    private:
+        Op op_;
+        term *a_;
+        std::vector<T> out_;
+    };
+
+    template<typename Op>
+    struct zipterm: public term
+    {
+        zipterm(Op op, term *a, term *b)
+            :op_(op), a_(a), b_(b)
+        { }
+
+        ~zipterm()
+        {
+            delete a_;
+            delete b_;
+        }
+
+        T *eval(std::size_t m)
+        {
+            const T *x = a_->eval(m);
+            T *out = room(out_, m);
+            stream_kernel<Op, T>::apply(op_, x, b_->eval(m), out, m);
+            return out;
+        }
+
+        T first()
+        {
+            const T x = a_->first();
+            return op_(x, b_->first());
+        }
+
+        void leaves(std::vector<leaf*> &r)
+        {
+            a_->leaves(r);
+            b_->leaves(r);
+        }
+
+        std::size_t lower(machine &m)
+        {
+            const std::size_t a = a_->lower(m);
+            return m.zip(op_, a, b_->lower(m));
+        }
+
+    private:
+        Op op_;
+        term *a_, *b_;
+        std::vector<T> out_;
+    };
+
+    // Runs a fused expression, as zipimpl2 with any number of operands.
+    // A fused node for t, where the elements can be buffered.
+    static impl *fused(term *t, const stream<T> *self, std::true_type)
+    {
+        return new fuseimpl(t, self);
+    }
+
+    static impl *fused(term *, const stream<T> *, std::false_type)
+    {
+        return 0;
+    }
+
+    struct fuseimpl: public impl
+    {
+        // self is the stream this node computes.
+        fuseimpl(term *t, const stream<T> *self)
+            :t_(t), self_(self), made_(0), busy_(false)
+        {
+            STREAM_STATS_NEW(fuse);
+            t_->leaves(leaves_);
+            for(leaf *l : leaves_)
+                l->start();
+        }
+
+        ~fuseimpl()
+        {
+            STREAM_STATS_DELETE(fuse);
+            delete t_;
+        }
+
+        const T &get(const iterator &it)
+        {
+            STREAM_STATS_COUNT(fuse, gets);
+            return step(it)->a_;
+        }
+
+        void next(iterator &it)
+        {
+            STREAM_STATS_COUNT(fuse, nexts);
+            it.move(step(it)->s_);
+        }
+
+        std::size_t fill(iterator &it, T *out, std::size_t n)
+        {
+            STREAM_STATS_COUNT(fuse, fills);
+            valimpl *x = 0;
+            const std::size_t m = run(it, out, n, &x);
+            if(m)
+                it.move(x->s_);
+            return m;
+        }
+
+        std::size_t drain(iterator &it, T *out, std::size_t n)
+        {
+            STREAM_STATS_COUNT(fuse, fills);
+            return run(it, out, n, 0);
+        }
+
+        // None of the operations need to run.
+        std::size_t skip(iterator &, std::size_t n)
+        {
+            if(busy_)
+                return 0;
+            busy_ = true;
+            for(leaf *l : leaves_)
+                l->skip(n);
+            made_ += n;
+            busy_ = false;
+            return n;
+        }
+
+        bool lower(machine &m, const stream<T> &s)
+        {
+            return resume(m, s, 0);
+        }
+
+        // As in mapimpl2, with a signal for each term.
+        bool resume(machine &m, const stream<T> &s, std::size_t k)
+        {
+            if(&s != self_ || (k != made_ && !m.owned(s)))
+                return false;
+            for(leaf *l : leaves_) {
+                if(!l->whole(m))
+                    return false;
+            }
+            m.same(s, t_->lower(m));
+            return true;
+        }
+
+        bool operands(std::vector<const stream<T>*> &r)
+        {
+            for(leaf *l : leaves_)
+                r.push_back(&l->operand());
+            return true;
+        }
+
+    private:
+        // The element goes in front before the leaves move on, as they
+        // may read it.
+        valimpl *step(const iterator &it)
+        {
+            valimpl *x = new valimpl(t_->first(), this);
+            it.slot() = x;
+            for(leaf *l : leaves_)
+                l->next();
+            ++made_;
+            return x;
+        }
+
+        std::size_t run(const iterator &it, T *out, std::size_t n, valimpl **last)
+        {
+            if(busy_)
+                return 0;
+
+            busy_ = true;
+            impl **slot = &it.slot();
+            std::size_t i = 0;
+            while(i < n) {
+                std::size_t m = std::min<std::size_t>(n-i, chunk);
+                for(leaf *l : leaves_)
+                    m = std::min(m, l->ahead(m));
+                if(!m)
+                    break;
+
+                // The results are scratch, moved out where nothing else
+                // needs them.
+                T *r = t_->eval(m);
+                if(out && last)
+                    std::copy(r, r+m, out+i);
+                else if(out)
+                    std::move(r, r+m, out+i);
+                for(std::size_t j=0; last && j<m; ++j) {
+                    *last = new valimpl(std::move(r[j]), this);
+                    *slot = *last;
+                    slot = &(*last)->s_.impl_;
+                }
+                for(leaf *l : leaves_)
+                    l->drop(m);
+                i += m;
+            }
+            made_ += i;
+            busy_ = false;
+            return i;
+        }
+
+        term *t_;
+        std::vector<leaf*> leaves_;
+        const stream<T> *self_;
+        std::size_t made_;
+        bool busy_;
+    };
+
+    // Whether a node may take the node of s over.
+    static bool fuses(const stream<T> &, std::true_type)
+    {
+        return false;
+    }
+
+    static bool fuses(const stream<T> &s, std::false_type)
+    {
+        return s.impl_ && s.impl_->fusible();
+    }
+
+    // The term reading s: the operations of its node, when s is owned and
+    // they fuse, or else a leaf.
+    template<typename ST>
+    static term *make_term(ST &s)
+    {
+        return new leafterm<ST&>(s);
+    }
+
+    static term *make_term(stream<T> &&s)
+    {
+        if(!fuses(s, std::false_type()))
+            return new leafterm<stream<T> >(std::move(s));
+        term *t = s.impl_->fuse();
+        delete s.impl_;
+        s.impl_ = 0;
+        return t;
+    }
+
+
+#ifdef HAVE_MMAP
+    /*
+     * The elements of a file of Ts, read from a mapping of it: after the
+     * last one the file starts over, or if after is given, it follows for
+     * ever. Nodes are made only for the elements readers keep; the rest
+     * are copied from the mapping straight to whoever drains them. No T
+     * is ever default constructed: the padding is copied into raw storage.
+     */
+    struct mmapimpl: public impl
+    {
+        mmapimpl(const std::string &path, const T *after)
+            :data_(0), bytes_(0), n_(0), i_(0), cycle_(!after)
+        {
+            if(after)
+                new(&pad_) T(*after);
+            std::FILE *f = std::fopen(path.c_str(), "rb");
+            if(!f)
+                fail(0, path);
+            struct stat st;
+            if(::fstat(fileno(f), &st) < 0)
+                fail(f, path);
+            bytes_ = st.st_size;
+            n_ = bytes_/sizeof(T);
+            if(bytes_) {
+                void *p = ::mmap(0, bytes_, PROT_READ, MAP_PRIVATE, fileno(f), 0);
+                if(p == MAP_FAILED)
+                    fail(f, path);
+                ::madvise(p, bytes_, MADV_SEQUENTIAL);
+                data_ = static_cast<const T*>(p);
+            }
+            std::fclose(f);
+            if(cycle_ && !n_) {
+                ::munmap(const_cast<T*>(data_), bytes_);
+                throw std::system_error(EINVAL, std::generic_category(), path);
+            }
+            STREAM_STATS_NEW(mmap);
+        }
+
+        ~mmapimpl()
+        {
+            STREAM_STATS_DELETE(mmap);
+            if(data_)
+                ::munmap(const_cast<T*>(data_), bytes_);
+        }
+
+        const T &get(const iterator &it)
+        {
+            STREAM_STATS_COUNT(mmap, gets);
+            return step(it)->a_;
+        }
+
+        void next(iterator &it)
+        {
+            STREAM_STATS_COUNT(mmap, nexts);
+            it.move(step(it)->s_);
+        }
+
+        std::size_t fill(iterator &it, T *out, std::size_t n)
+        {
+            STREAM_STATS_COUNT(mmap, fills);
+            read(out, n);
+            impl **slot = &it.slot();
+            valimpl *x = 0;
+            for(std::size_t i=0; i<n; ++i) {
+                x = new valimpl(out[i], this);
+                *slot = x;
+                slot = &x->s_.impl_;
+            }
+            it.move(x->s_);
+            return n;
+        }
+
+        std::size_t drain(iterator &, T *out, std::size_t n)
+        {
+            STREAM_STATS_COUNT(mmap, fills);
+            read(out, n);
+            return n;
+        }
+
+        std::size_t skip(iterator &, std::size_t n)
+        {
+            if(cycle_)
+                i_ = (i_ + n%n_) % n_;
+            else
+                i_ += std::min(n, n_-i_);
+            return n;
+        }
+
+        bool operands(std::vector<const stream<T>*> &)
+        {
+            return true;
+        }
+
+    private:
+        static void fail(std::FILE *f, const std::string &path)
+        {
+            const int e = errno;
+            if(f)
+                std::fclose(f);
+            throw std::system_error(e, std::generic_category(), path);
+        }
+
+        valimpl *step(const iterator &it)
+        {
+            valimpl *x = new valimpl(take(), this);
+            it.slot() = x;
+            return x;
+        }
+
+        // The next element, from the mapping or the padding after it.
+        const T &take()
+        {
+            if(i_ == n_ && cycle_)
+                i_ = 0;
+            return i_ == n_ ? pad() : data_[i_++];
+        }
+
+        const T &pad() const { return *reinterpret_cast<const T*>(&pad_); }
+
+        // Copies the next n elements to out.
+        void read(T *out, std::size_t n)
+        {
+            while(n) {
+                if(i_ == n_ && cycle_)
+                    i_ = 0;
+                if(i_ == n_) {
+                    std::fill(out, out+n, pad());
+                    return;
+                }
+                const std::size_t m = std::min(n, n_-i_);
+                std::copy(data_+i_, data_+i_+m, out);
+                out += m;
+                n -= m;
+                i_ += m;
+            }
+        }
+
+        const T *data_;
+        std::size_t bytes_, n_, i_;
+        const bool cycle_;
+        typename std::aligned_storage<sizeof(T), alignof(T)>::type pad_;
+    };
+#endif
+
+    /*
+     * Evaluates its input on a thread of its own into a ring of capacity
+     * elements, one producer and one consumer, ahead of the readers of
+     * this node. The producer publishes what it computed after each run
+     * of elements, the consumer frees each element as it takes it. The
+     * ring holds raw storage, so elements need no default constructor. An
+     * exception in the producer ends the ring: the readers get the
+     * elements before it, then the exception.
+     */
+    template<typename ST>
+    struct asyncimpl: public impl
+    {
+        typedef typename std::is_lvalue_reference<ST>::type by_ref;
+        typedef typename std::aligned_storage<sizeof(T), alignof(T)>::type cell;
+
+        asyncimpl(ST &&s, std::size_t capacity, async_wait wait)
+            :s_(std::forward<ST>(s)), it1(mine(s_)),
+            ring_(new cell[round(capacity)]), mask_(round(capacity)-1), wait_(wait),
+            head_(0), tail_(0), stop_(false), failed_(false), sleeping_(0)
+        {
+            own(s_, by_ref());
+            thread_ = std::thread(&asyncimpl::work, this);
+            STREAM_STATS_NEW(async);
+        }
+
+        ~asyncimpl()
+        {
+            STREAM_STATS_DELETE(async);
+            stop_ = true;
+            wake();
+            thread_.join();
+            const std::size_t h = head_.load(std::memory_order_relaxed);
+            for(std::size_t t=tail_.load(std::memory_order_relaxed); t!=h; ++t)
+                at(t)->~T();
+        }
+
+        const T &get(const iterator &it)
+        {
+            STREAM_STATS_COUNT(async, gets);
+            return step(it)->a_;
+        }
+
+        void next(iterator &it)
+        {
+            STREAM_STATS_COUNT(async, nexts);
+            it.move(step(it)->s_);
+        }
+
+        std::size_t fill(iterator &it, T *out, std::size_t n)
+        {
+            STREAM_STATS_COUNT(async, fills);
+            const std::size_t m = pop(out, n);
+            impl **slot = &it.slot();
+            valimpl *x = 0;
+            for(std::size_t j=0; j<m; ++j) {
+                x = new valimpl(out[j], this);
+                *slot = x;
+                slot = &x->s_.impl_;
+            }
+            it.move(x->s_);
+            return m;
+        }
+
+        std::size_t drain(iterator &, T *out, std::size_t n)
+        {
+            STREAM_STATS_COUNT(async, fills);
+            return pop(out, n);
+        }
+
+    private:
+        static std::size_t round(std::size_t n)
+        {
+            std::size_t r = 1;
+            while(r < n)
+                r *= 2;
+            return r;
+        }
+
+        // Whether nothing stands on, or is about to read, any stream s
+        // reads, as far as its nodes can tell.
+        static bool unread(const stream<T> &s)
+        {
+            std::set<const stream<T>*> seen;
+            if(!closure(s, seen))
+                return true;
+            for(const stream<T> *x : seen)
+                if(x->readers_ || x->pending_)
+                    return false;
+            return true;
+        }
+
+        // The producer's iterator. From here on its thread is the only
+        // one to touch the nodes s reads.
+        static iterator mine(const stream<T> &s)
+        {
+            assert(unread(s));
+            return s.begin();
+        }
+
+        T *at(std::size_t i)
+        {
+            return reinterpret_cast<T*>(&ring_[i & mask_]);
+        }
+
+        valimpl *step(const iterator &it)
+        {
+            const std::size_t t = tail_.load(std::memory_order_relaxed);
+            arrived(t);
+            valimpl *x = new valimpl(std::move(*at(t)), this);
+            at(t)->~T();
+            tail_.store(t+1, std::memory_order_release);
+            wake();
+            it.slot() = x;
+            return x;
+        }
+
+        // Takes at least one element and at most n, waiting for the first.
+        std::size_t pop(T *out, std::size_t n)
+        {
+            const std::size_t t = tail_.load(std::memory_order_relaxed);
+            const std::size_t m = std::min(n, arrived(t)-t);
+            for(std::size_t i=0; i<m; ++i) {
+                out[i] = std::move(*at(t+i));
+                at(t+i)->~T();
+            }
+            tail_.store(t+m, std::memory_order_release);
+            wake();
+            return m;
+        }
+
+        // Waits for the element at t and returns the producer's position,
+        // or rethrows what stopped the producer before it.
+        std::size_t arrived(std::size_t t)
+        {
+            std::size_t h;
+            await([&] {
+                return (h = head_.load(std::memory_order_acquire)) != t ||
+                    failed_.load(std::memory_order_acquire);
+            });
+            if(h == t)
+                h = head_.load(std::memory_order_acquire);
+            if(h == t)
+                std::rethrow_exception(error_);
+            return h;
+        }
+
+        void work()
+        {
+            try {
+                produce(buffers());
+            } catch(...) {
+                error_ = std::current_exception();
+                failed_.store(true, std::memory_order_release);
+                wake();
+            }
+        }
+
+        // Runs of elements, when they can be buffered.
+        void produce(std::true_type)
+        {
+            const std::size_t run = std::max<std::size_t>(1, std::min<std::size_t>(chunk, (mask_+1)/4));
+            std::vector<T> in(run);
+            for(;;) {
+                const std::size_t m = pull(it1, &in[0], run, by_ref());
+                assert(m);
+                for(std::size_t i=0; i<m; ) {
+                    std::size_t h, k;
+                    if(!space(h, k))
+                        return;
+                    k = std::min(m-i, k);
+                    for(std::size_t j=0; j<k; ++j)
+                        new(at(h+j)) T(std::move(in[i+j]));
+                    head_.store(h+k, std::memory_order_release);
+                    wake();
+                    i += k;
+                }
+            }
+        }
+
+        // One element at a time, constructed right in the ring.
+        void produce(std::false_type)
+        {
+            for(;;) {
+                std::size_t h, k;
+                if(!space(h, k))
+                    return;
+                new(at(h)) T(*it1);
+                ++it1;
+                head_.store(h+1, std::memory_order_release);
+                wake();
+            }
+        }
+
+        // Waits for k free cells from h on; false once the node goes.
+        bool space(std::size_t &h, std::size_t &k)
+        {
+            h = head_.load(std::memory_order_relaxed);
+            std::size_t t;
+            await([&] {
+                return stop_ || h - (t = tail_.load(std::memory_order_acquire)) <= mask_;
+            });
+            if(stop_)
+                return false;
+            k = mask_+1 - (h-t);
+            return true;
+        }
+
+        // Spins, or sleeps until the other side moved, until ready().
+        template<typename F>
+        void await(F ready)
+        {
+            if(wait_ == async_wait::spin) {
+                for(int i=0; !ready(); ++i)
+                    if(i > 1000)
+                        std::this_thread::yield();
+                return;
+            }
+
+            if(ready())
+                return;
+            std::unique_lock<std::mutex> lock(mutex_);
+            ++sleeping_;
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            cv_.wait(lock, ready);
+            --sleeping_;
+        }
+
+        // The fences pair with the one in await(): either the sleeper sees
+        // the new position, or this sees the sleeper.
+        void wake()
+        {
+            if(wait_ != async_wait::block)
+                return;
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if(sleeping_.load(std::memory_order_relaxed)) {
+                std::lock_guard<std::mutex> lock(mutex_);
+                cv_.notify_all();
+            }
+        }
+
+        typename storage_type<ST>::type s_;
+        iterator it1;
+        std::unique_ptr<cell[]> ring_;
+        const std::size_t mask_;
+        const async_wait wait_;
+
+        // Producer and consumer positions, a cache line apart. The node
+        // comes from the pool, which aligns no further than new does, so
+        // padding keeps them apart where alignas could not.
+        std::atomic<std::size_t> head_;
+        char pad1_[64];
+        std::atomic<std::size_t> tail_;
+        char pad2_[64];
+        std::atomic<bool> stop_, failed_;
+        std::exception_ptr error_;
+        std::atomic<int> sleeping_;
+        std::mutex mutex_;
+        std::condition_variable cv_;
+        std::thread thread_;
+    };
+
+    /*
+     * init, init op s0, (init op s0) op s1 and so on, the definition
+     * sums = init <<= sums op s as a single node. An element of s is asked
+     * for only when the sum that needs it is read, so s may read this
+     * stream up to the element before. Runs of an associative op are
+     * summed on the pool in two passes: each block reduced on its own,
+     * then each block scanned from the total of the blocks before it.
+     * Like mapimpl, the node waits for its first read to start.
+     */
+    template<typename Op, typename ST>
+    struct scanimpl: public impl
+    {
+        typedef typename std::is_lvalue_reference<ST>::type by_ref;
+
+        scanimpl(Op op, const T &init, ST &&s)
+            :s_(std::forward<ST>(s)), op_(op), init_(init), regs_(0)
+        {
+            STREAM_STATS_NEW(scan);
+        }
+
+        ~scanimpl()
+        {
+            STREAM_STATS_DELETE(scan);
+        }
+
+        const T &get(const iterator &it)
+        {
+            STREAM_STATS_COUNT(scan, gets);
+            start(it);
+            return *it;
+        }
+
+        void next(iterator &it)
+        {
+            STREAM_STATS_COUNT(scan, nexts);
+            start(it);
+            ++it;
+        }
+
+        std::size_t fill(iterator &it, T *out, std::size_t n)
+        {
+            STREAM_STATS_COUNT(scan, fills);
+            start(it);
+            return it.slot()->fill(it, out, n);
+        }
+
+        std::size_t drain(iterator &it, T *out, std::size_t n)
+        {
+            STREAM_STATS_COUNT(scan, fills);
+            start(it);
+            return it.slot()->drain(it, out, n);
+        }
+
+        void reach(int d)
+        {
+            regs_ += d;
+            stream<T>::reach(s_, d, by_ref());
+        }
+
+        bool operands(std::vector<const stream<T>*> &r)
+        {
+            r.push_back(&s_);
+            return true;
+        }
+
+    private:
+        void start(const iterator &it)
+        {
+            reach(-regs_);
+            it.slot() = 0;
+            impl *x = new scanimpl2<Op, ST>(op_, init_, std::forward<ST>(s_));
+            it.slot() = x;
+            delete this;
+        }
+
+        typename storage_type<ST>::type s_;
+        Op op_;
+        T init_;
+        int regs_;
+    };
+
+    template<typename Op, typename ST>
+    struct scanimpl2: public impl
+    {
+        typedef typename std::is_lvalue_reference<ST>::type by_ref;
+        typedef stream_associative<Op, T> assoc;
+
+        // Elements pulled at once when the pool may sum them.
+        enum { wide = 16*chunk };
+
+        scanimpl2(Op op, const T &init, ST &&s)
+            :s_(std::forward<ST>(s)), it1(s_.begin()), op_(op), acc_(init),
+            due_(false), busy_(false)
+        {
+            STREAM_STATS_NEW(scan2);
+            own(s_, by_ref());
+        }
+
+        ~scanimpl2()
+        {
+            STREAM_STATS_DELETE(scan2);
+        }
+
+        const T &get(const iterator &it)
+        {
+            STREAM_STATS_COUNT(scan2, gets);
+            return step(it)->a_;
+        }
+
+        void next(iterator &it)
+        {
+            STREAM_STATS_COUNT(scan2, nexts);
+            it.move(step(it)->s_);
+        }
+
+        std::size_t fill(iterator &it, T *out, std::size_t n)
+        {
+            STREAM_STATS_COUNT(scan2, fills);
+            valimpl *x = 0;
+            const std::size_t m = run(it, out, n, &x);
+            if(m)
+                it.move(x->s_);
+            return m;
+        }
+
+        std::size_t drain(iterator &it, T *out, std::size_t n)
+        {
+            STREAM_STATS_COUNT(scan2, fills);
+            return run(it, out, n, 0);
+        }
+
+        bool operands(std::vector<const stream<T>*> &r)
+        {
+            r.push_back(&s_);
+            return true;
+        }
+
+    private:
+        valimpl *step(const iterator &it)
+        {
+            if(due_) {
+                acc_ = op_(acc_, *it1);
+                ++it1;
+            }
+            due_ = true;
+            valimpl *x = new valimpl(acc_, this);
+            it.slot() = x;
+            return x;
+        }
+
+        // As in mapimpl2; acc_ is the last sum given out once due_ is set.
+        std::size_t run(const iterator &it, T *out, std::size_t n, valimpl **last)
+        {
+            if(busy_)
+                return 0;
+
+            busy_ = true;
+            impl **slot = &it.slot();
+            std::size_t i = 0;
+            while(i < n) {
+                const std::size_t cap = assoc::value ? std::size_t(wide) : std::size_t(chunk);
+                const std::size_t want = std::min(n-i, cap);
+                std::size_t m = 1;
+                if(due_) {
+                    m = pull(it1, room(in_, want), want, by_ref());
+                    if(!m)
+                        break;
+                    sum(&in_[0], m);
+                } else {
+                    room(in_, 1)[0] = acc_;
+                    due_ = true;
+                }
+
+                if(out)
+                    std::copy(&in_[0], &in_[0]+m, out+i);
+                for(std::size_t j=0; last && j<m; ++j) {
+                    *last = new valimpl(std::move(in_[j]), this);
+                    *slot = *last;
+                    slot = &(*last)->s_.impl_;
+                }
+                i += m;
+            }
+            busy_ = false;
+            return i;
+        }
+
+        // Replaces a[0..m) by the sums after each of them.
+        void sum(T *a, std::size_t m)
+        {
+            stream_pool &p = stream_pool::instance();
+            if(!assoc::value || m < 2*chunk || !p.workers()) {
+                for(std::size_t j=0; j<m; ++j)
+                    a[j] = acc_ = op_(acc_, a[j]);
+                return;
+            }
+
+            const std::size_t b = std::min<std::size_t>(m/chunk, 4*(p.workers()+1));
+            const std::size_t size = (m+b-1)/b;
+            part_.resize(b);
+            p.split(0, b, 1, [&](std::size_t i, std::size_t j) {
+                for(std::size_t k=i; k<j; ++k) {
+                    const std::size_t lo = k*size, hi = std::min(m, lo+size);
+                    T r = a[lo];
+                    for(std::size_t x=lo+1; x<hi; ++x)
+                        r = op_(r, a[x]);
+                    part_[k] = r;
+                }
+            });
+            for(std::size_t k=0; k<b; ++k) {
+                const T r = part_[k];
+                part_[k] = acc_;
+                acc_ = op_(acc_, r);
+            }
+            p.split(0, b, 1, [&](std::size_t i, std::size_t j) {
+                for(std::size_t k=i; k<j; ++k) {
+                    const std::size_t lo = k*size, hi = std::min(m, lo+size);
+                    T r = part_[k];
+                    for(std::size_t x=lo; x<hi; ++x)
+                        a[x] = r = op_(r, a[x]);
+                }
+            });
+        }
+
+        typename storage_type<ST>::type s_;
+        iterator it1;
+        Op op_;
+        T acc_;
+        bool due_;
+        std::vector<T> in_, part_;
+        bool busy_;
+    };
+
+    /*
+     * The Cauchy product of two power series, c_n = sum of a_i b_(n-i),
+     * where c_n reads no coefficient past a_n and b_n, so a definition
+     * may multiply itself after a prefix. The products are added in
+     * blocks, relaxed: the block of a_x b_y with y in [s, 2s) for the
+     * power of two s <= x, and x in an aligned run of s, is added once
+     * the run is known, and the same with a and b swapped for y past 2s.
+     * Each block lands past the coefficient being read, and n of them
+     * cost O(n log^2 n) with transforms for the big blocks of integers.
+     * Like zipimpl, the node waits for its first read to start.
+     */
+    template<typename ST1, typename ST2>
+    struct seriesimpl: public impl
+    {
+        typedef typename std::is_lvalue_reference<ST1>::type by_ref1;
+        typedef typename std::is_lvalue_reference<ST2>::type by_ref2;
+
+        seriesimpl(ST1 &&s1, ST2 &&s2)
+            :s1_(std::forward<ST1>(s1)), s2_(std::forward<ST2>(s2)), regs_(0)
+        {
+            STREAM_STATS_NEW(series);
+            cons(s1_, s2_, std::integral_constant<bool,
+                !by_ref1::value && !by_ref2::value>());
+        }
+
+        ~seriesimpl()
+        {
+            STREAM_STATS_DELETE(series);
+        }
+
+        const T &get(const iterator &it)
+        {
+            STREAM_STATS_COUNT(series, gets);
+            start(it);
+            return *it;
+        }
+
+        void next(iterator &it)
+        {
+            STREAM_STATS_COUNT(series, nexts);
+            start(it);
+            ++it;
+        }
+
+        std::size_t fill(iterator &it, T *out, std::size_t n)
+        {
+            STREAM_STATS_COUNT(series, fills);
+            start(it);
+            return it.slot()->fill(it, out, n);
+        }
+
+        std::size_t drain(iterator &it, T *out, std::size_t n)
+        {
+            STREAM_STATS_COUNT(series, fills);
+            start(it);
+            return it.slot()->drain(it, out, n);
+        }
+
+        void reach(int d)
+        {
+            regs_ += d;
+            stream<T>::reach(s1_, d, by_ref1());
+            stream<T>::reach(s2_, d, by_ref2());
+        }
+
+        bool operands(std::vector<const stream<T>*> &r)
+        {
+            r.push_back(&s1_);
+            r.push_back(&s2_);
+            return true;
+        }
+
+    private:
+        void start(const iterator &it)
+        {
+            reach(-regs_);
+            it.slot() = 0;
+            impl *x = new seriesimpl2<ST1, ST2>(std::forward<ST1>(s1_), std::forward<ST2>(s2_));
+            it.slot() = x;
+            delete this;
+        }
+
+        typename storage_type<ST1>::type s1_;
+        typename storage_type<ST2>::type s2_;
+        int regs_;
+    };
+
+    template<typename ST1, typename ST2>
+    struct seriesimpl2: public impl
+    {
+        typedef typename std::is_lvalue_reference<ST1>::type by_ref1;
+        typedef typename std::is_lvalue_reference<ST2>::type by_ref2;
+        typedef std::integral_constant<bool, std::is_integral<T>::value &&
+            !std::is_same<T, bool>::value && sizeof(T) <= 8> exact;
+
+        // Blocks below this size are multiplied term by term.
+        enum { naive = 512 };
+
+        seriesimpl2(ST1 &&s1, ST2 &&s2)
+            :s1_(std::forward<ST1>(s1)), s2_(std::forward<ST2>(s2)),
+            it1(s1_.begin()), it2(s2_.begin()),
+            n1_(0), n2_(0), busy_(false)
+        {
+            STREAM_STATS_NEW(series2);
+            own(s1_, by_ref1());
+            own(s2_, by_ref2());
+        }
+
+        ~seriesimpl2()
+        {
+            STREAM_STATS_DELETE(series2);
+        }
+
+        const T &get(const iterator &it)
+        {
+            STREAM_STATS_COUNT(series2, gets);
+            return step(it)->a_;
+        }
+
+        void next(iterator &it)
+        {
+            STREAM_STATS_COUNT(series2, nexts);
+            it.move(step(it)->s_);
+        }
+
+        std::size_t fill(iterator &it, T *out, std::size_t n)
+        {
+            STREAM_STATS_COUNT(series2, fills);
+            valimpl *x = 0;
+            const std::size_t m = run(it, out, n, &x);
+            if(m)
+                it.move(x->s_);
+            return m;
+        }
+
+        std::size_t drain(iterator &it, T *out, std::size_t n)
+        {
+            STREAM_STATS_COUNT(series2, fills);
+            return run(it, out, n, 0);
+        }
+
+        bool operands(std::vector<const stream<T>*> &r)
+        {
+            r.push_back(&s1_);
+            r.push_back(&s2_);
+            return true;
+        }
+
+    private:
+        valimpl *step(const iterator &it)
+        {
+            valimpl *x = 0;
+            run(it, 0, 1, &x);
+            assert(x);
+            return x;
+        }
+
+        // As in zipimpl2, one coefficient after the other.
+        std::size_t run(const iterator &it, T *out, std::size_t n, valimpl **last)
+        {
+            if(busy_)
+                return 0;
+
+            busy_ = true;
+            impl **slot = &it.slot();
+            std::size_t i = 0;
+            while(i < n) {
+                const std::size_t want = std::min<std::size_t>(n-i, chunk);
+                if(n1_ < want)
+                    n1_ += pull(it1, room(in1_, want)+n1_, want-n1_, by_ref1());
+                if(n2_ < want)
+                    n2_ += pull(it2, room(in2_, want)+n2_, want-n2_, by_ref2());
+
+                const std::size_t m = std::min(want, std::min(n1_, n2_));
+                if(!m)
+                    break;
+
+                for(std::size_t j=0; j<m; ++j) {
+                    T c = add(in1_[j], in2_[j]);
+                    if(out)
+                        out[i+j] = c;
+                    if(last) {
+                        *last = new valimpl(std::move(c), this);
+                        *slot = *last;
+                        slot = &(*last)->s_.impl_;
+                    }
+                }
+                std::move(in1_.begin()+m, in1_.begin()+n1_, in1_.begin());
+                std::move(in2_.begin()+m, in2_.begin()+n2_, in2_.begin());
+                n1_ -= m;
+                n2_ -= m;
+                i += m;
+            }
+            busy_ = false;
+            return i;
+        }
+
+        // Takes a_i and b_i and gives c_i.
+        T add(const T &x, const T &y)
+        {
+            const std::size_t i = a_.size();
+            a_.push_back(x);
+            b_.push_back(y);
+            if(c_.size() < 2*(i+1))
+                c_.resize(4*(i+1), T());
+
+            if(i == 0) {
+                c_[0] = c_[0] + a_[0]*b_[0];
+            } else {
+                c_[i] = c_[i] + a_[i]*b_[0];
+                c_[i] = c_[i] + a_[0]*b_[i];
+            }
+            for(std::size_t s=1; (i+1) % s == 0; s *= 2) {
+                const std::size_t q = (i+1)/s;
+                if(q >= 2)
+                    block(&a_[i+1-s], &b_[s], s, &c_[i+1]);
+                if(q >= 3)
+                    block(&b_[i+1-s], &a_[s], s, &c_[i+1]);
+            }
+            return c_[i];
+        }
+
+        // Adds x*y to out, for x and y of s terms each.
+        static void block(const T *x, const T *y, std::size_t s, T *out)
+        {
+            if(s < naive)
+                block(x, y, s, out, std::false_type());
+            else
+                block(x, y, s, out, exact());
+        }
+
+        static void block(const T *x, const T *y, std::size_t s, T *out, std::false_type)
+        {
+            for(std::size_t i=0; i<s; ++i)
+                for(std::size_t j=0; j<s; ++j)
+                    out[i+j] = out[i+j] + x[i]*y[j];
+        }
+
+        static void block(const T *x, const T *y, std::size_t s, T *out, std::true_type)
+        {
+            typedef series_ntt::u64 u64;
+            const std::size_t k = std::min<std::size_t>(s, series_ntt::max_length);
+            std::vector<u64> a(k), b(k), c(2*k-1);
+            for(std::size_t i=0; i<s; i+=k)
+                for(std::size_t j=0; j<s; j+=k) {
+                    for(std::size_t l=0; l<k; ++l) {
+                        a[l] = u64(x[i+l]);
+                        b[l] = u64(y[j+l]);
+                    }
+                    std::fill(c.begin(), c.end(), 0);
+                    series_ntt::convolve(&a[0], k, &b[0], k, &c[0]);
+                    for(std::size_t l=0; l<2*k-1; ++l)
+                        out[i+j+l] = T(u64(out[i+j+l]) + c[l]);
+                }
+        }
+
+        typename storage_type<ST1>::type s1_;
+        typename storage_type<ST2>::type s2_;
+        iterator it1, it2;
+        std::vector<T> in1_, in2_;
+        std::size_t n1_, n2_;
+        bool busy_;
+
+        // The coefficients read so far, and the sums started for c.
+        std::vector<T> a_, b_, c_;
+    };
+
+    /*
+     * The sum of the last k elements, kept in a ring to take them out.
+     * Floating point sums also carry what rounding lost (Neumaier) and
+     * are summed afresh from the ring each time it turns, so a large
+     * element that has left the window leaves no error behind.
+     */
+    struct window_total
+    {
+        typedef typename std::is_floating_point<T>::type inexact;
+
+        explicit window_total(std::size_t k)
+            :ring_(k), sum_(), fix_(), i_(0), n_(0)
+        { }
+
+        void push(const T &x)
+        {
+            if(n_ == ring_.size())
+                take(ring_[i_], inexact());
+            else
+                ++n_;
+            add(x, inexact());
+            ring_[i_] = x;
+            i_ = i_+1 == ring_.size() ? 0 : i_+1;
+            if(i_ == 0)
+                recount(inexact());
+        }
+
+        T value() const { return sum_ + fix_; }
+
+        void add(const T &x, std::false_type) { sum_ = sum_ + x; }
+        void take(const T &x, std::false_type) { sum_ = sum_ - x; }
+        void recount(std::false_type) { }
+
+        void add(const T &x, std::true_type)
+        {
+            const T t = sum_ + x;
+            fix_ += std::abs(sum_) >= std::abs(x) ? (sum_ - t) + x : (x - t) + sum_;
+            sum_ = t;
+        }
+
+        void take(const T &x, std::true_type) { add(-x, std::true_type()); }
+
+        void recount(std::true_type)
+        {
+            sum_ = fix_ = T();
+            for(std::size_t j=0; j<n_; ++j)
+                add(ring_[j], std::true_type());
+        }
+
+        std::vector<T> ring_;
+        T sum_, fix_;
+        std::size_t i_, n_;
+    };
+
+    // Divides by the elements in the window, fewer than k at first.
+    struct window_average: window_total
+    {
+        explicit window_average(std::size_t k)
+            :window_total(k)
+        { }
+
+        T value() const { return window_total::value() / T(this->n_); }
+    };
+
+    // The first of the last k elements by Cmp: a queue of the elements no
+    // later one comes before, by Cmp, each with its position.
+    template<typename Cmp>
+    struct window_first
+    {
+        explicit window_first(std::size_t k)
+            :k_(k), n_(0)
+        { }
+
+        void push(const T &x)
+        {
+            while(!q_.empty() && !Cmp()(q_.back().second, x))
+                q_.pop_back();
+            q_.push_back(std::make_pair(n_++, x));
+            if(q_.front().first + k_ < n_)
+                q_.pop_front();
+        }
+
+        const T &value() const { return q_.front().second; }
+
+        std::deque<std::pair<std::size_t, T> > q_;
+        std::size_t k_, n_;
+    };
+
+    /*
+     * Element n of the window of the last k elements of s up to n, fewer
+     * at the start, as one node for every k: W takes each element in and
+     * gives the aggregate in O(1) amortized.
+     */
+    template<typename W, typename ST>
+    struct windowimpl: public impl
+    {
+        typedef typename std::is_lvalue_reference<ST>::type by_ref;
+
+        windowimpl(std::size_t k, ST &&s)
+            :s_(std::forward<ST>(s)), k_(k), regs_(0)
+        {
+            STREAM_STATS_NEW(window);
+        }
+
+        ~windowimpl()
+        {
+            STREAM_STATS_DELETE(window);
+        }
+
+        const T &get(const iterator &it)
+        {
+            STREAM_STATS_COUNT(window, gets);
+            start(it);
+            return *it;
+        }
+
+        void next(iterator &it)
+        {
+            STREAM_STATS_COUNT(window, nexts);
+            start(it);
+            ++it;
+        }
+
+        std::size_t fill(iterator &it, T *out, std::size_t n)
+        {
+            STREAM_STATS_COUNT(window, fills);
+            start(it);
+            return it.slot()->fill(it, out, n);
+        }
+
+        std::size_t drain(iterator &it, T *out, std::size_t n)
+        {
+            STREAM_STATS_COUNT(window, fills);
+            start(it);
+            return it.slot()->drain(it, out, n);
+        }
+
+        void reach(int d)
+        {
+            regs_ += d;
+            stream<T>::reach(s_, d, by_ref());
+        }
+
+        bool operands(std::vector<const stream<T>*> &r)
+        {
+            r.push_back(&s_);
+            return true;
+        }
+
+    private:
+        void start(const iterator &it)
+        {
+            reach(-regs_);
+            it.slot() = 0;
+            impl *x = new windowimpl2<W, ST>(k_, std::forward<ST>(s_));
+            it.slot() = x;
+            delete this;
+        }
+
+        typename storage_type<ST>::type s_;
+        std::size_t k_;
+        int regs_;
+    };
+
+    template<typename W, typename ST>
+    struct windowimpl2: public impl
+    {
+        typedef typename std::is_lvalue_reference<ST>::type by_ref;
+
+        windowimpl2(std::size_t k, ST &&s)
+            :s_(std::forward<ST>(s)), it1(s_.begin()), w_(k), busy_(false)
+        {
+            STREAM_STATS_NEW(window2);
+            own(s_, by_ref());
+        }
+
+        ~windowimpl2()
+        {
+            STREAM_STATS_DELETE(window2);
+        }
+
+        const T &get(const iterator &it)
+        {
+            STREAM_STATS_COUNT(window2, gets);
+            return step(it)->a_;
+        }
+
+        void next(iterator &it)
+        {
+            STREAM_STATS_COUNT(window2, nexts);
+            it.move(step(it)->s_);
+        }
+
+        std::size_t fill(iterator &it, T *out, std::size_t n)
+        {
+            STREAM_STATS_COUNT(window2, fills);
+            valimpl *x = 0;
+            const std::size_t m = run(it, out, n, &x);
+            if(m)
+                it.move(x->s_);
+            return m;
+        }
+
+        std::size_t drain(iterator &it, T *out, std::size_t n)
+        {
+            STREAM_STATS_COUNT(window2, fills);
+            return run(it, out, n, 0);
+        }
+
+        bool operands(std::vector<const stream<T>*> &r)
+        {
+            r.push_back(&s_);
+            return true;
+        }
+
+    private:
+        valimpl *step(const iterator &it)
+        {
+            w_.push(*it1);
+            ++it1;
+            valimpl *x = new valimpl(w_.value(), this);
+            it.slot() = x;
+            return x;
+        }
+
+        // As in mapimpl2.
+        std::size_t run(const iterator &it, T *out, std::size_t n, valimpl **last)
+        {
+            if(busy_)
+                return 0;
+
+            busy_ = true;
+            impl **slot = &it.slot();
+            std::size_t i = 0;
+            while(i < n) {
+                const std::size_t want = std::min<std::size_t>(n-i, chunk);
+                const std::size_t m = pull(it1, room(in_, want), want, by_ref());
+                if(!m)
+                    break;
+
+                for(std::size_t j=0; j<m; ++j) {
+                    w_.push(in_[j]);
+                    if(out)
+                        out[i+j] = w_.value();
+                    if(last) {
+                        *last = new valimpl(w_.value(), this);
+                        *slot = *last;
+                        slot = &(*last)->s_.impl_;
+                    }
+                }
+                i += m;
+            }
+            busy_ = false;
+            return i;
+        }
+
+        typename storage_type<ST>::type s_;
+        iterator it1;
+        W w_;
+        std::vector<T> in_;
+        bool busy_;
+    };
+
+    // A position inside a node that spans several elements.
+    struct slot;
+
+    /*
+     * k copies of init in front of s in a single node, instead of k nested
+     * addimpls. The positions inside the prefix are the slots of one
+     * array, all served by this node; the last one moves the reader on
+     * to s.
+     */
+    template<typename Slots, typename ST>
+    struct delayimpl: public impl
+    {
+        typedef typename std::is_lvalue_reference<ST>::type by_ref;
+
+        delayimpl(Slots slots, const T &init, ST &&s)
+            :slots_(std::move(slots)), init_(init), s_(std::forward<ST>(s)),
+            regs_(0)
+        {
+            STREAM_STATS_NEW(delay);
+            for(slot &x : slots_)
+                x.impl_ = this;
+        }
+
+        ~delayimpl()
+        {
+            STREAM_STATS_DELETE(delay);
+            for(slot &x : slots_)
+                x.impl_ = 0;
+        }
+
+        const T &get(const iterator &)
+        {
+            STREAM_STATS_COUNT(delay, gets);
+            return init_;
+        }
+
+        void next(iterator &it)
+        {
+            STREAM_STATS_COUNT(delay, nexts);
+            seek(it, pos(it)+1);
+        }
+
+        std::size_t fill(iterator &it, T *out, std::size_t n)
+        {
+            STREAM_STATS_COUNT(delay, fills);
+            const std::size_t p = pos(it);
+            const std::size_t m = std::min(n, slots_.size()+1-p);
+            std::fill(out, out+m, init_);
+            seek(it, p+m);
+            return m;
+        }
+
+        void reach(int d)
+        {
+            if(by_ref::value)
+                regs_ += d;
+            stream<T>::reach(s_, d, by_ref());
+        }
+
+        bool lower(machine &m, const stream<T> &s)
+        {
+            return lower(m, s, buffers());
+        }
+
+        bool lower(machine &, const stream<T> &, std::false_type)
+        {
+            return false;
+        }
+
+        bool lower(machine &m, const stream<T> &s, std::true_type)
+        {
+            m.prefix(s, slots_.size()+1-pos(&s), init_, s_);
+            return true;
+        }
+
+        bool operands(std::vector<const stream<T>*> &r)
+        {
+            r.push_back(&s_);
+            return true;
+        }
+
+    private:
+        // Index of the element the iterator is at inside the prefix.
+        std::size_t pos(const iterator &it) const
+        {
+            return pos(it.s_);
+        }
+
+        std::size_t pos(const stream<T> *s) const
+        {
+            const std::size_t n = slots_.size();
+            const std::less<const stream<T>*> before = std::less<const stream<T>*>();
+            if(n && !before(s, &slots_[0]) && !before(&slots_[n-1], s))
+                return static_cast<const slot*>(s) - &slots_[0] + 1;
+            return 0;
+        }
+
+        void seek(iterator &it, std::size_t i)
+        {
+            if(i <= slots_.size()) {
+                it.move(slots_[i-1]);
+                return;
+            }
+
+            it.move(s_);
+            if(by_ref::value) {
+                s_.reach();
+                if(regs_) {
+                    --regs_;
+                    stream<T>::reach(s_, -1, by_ref());
+                }
+            }
+        }
+
+        Slots slots_;
+        const T init_;
+        typename storage_type<ST>::type s_;
+        int regs_;
+    };
+
+    // Evaluates a whole expression template per element; its leaves are
+    // the only iterators left.
+    template<typename N>
+    struct exprimpl2: public impl
+    {
+        exprimpl2(N &&n)
+            :n_(std::move(n))
+        {
+            STREAM_STATS_NEW(expr2);
+            n_.start();
+        }
+
+        ~exprimpl2()
+        {
+            STREAM_STATS_DELETE(expr2);
+        }
+
+        const T &get(const iterator &it)
+        {
+            STREAM_STATS_COUNT(expr2, gets);
+            return step(it)->a_;
+        }
+
+        void next(iterator &it)
+        {
+            STREAM_STATS_COUNT(expr2, nexts);
+            it.move(step(it)->s_);
+        }
+
+        std::size_t fill(iterator &it, T *out, std::size_t n)
+        {
+            STREAM_STATS_COUNT(expr2, fills);
+            impl **slot = &it.slot();
+            valimpl *x = 0;
+            for(std::size_t i=0; i<n; ++i) {
+                x = new valimpl(n_.get(), this);
+                *slot = x;
+                slot = &x->s_.impl_;
+                n_.next();
+                out[i] = x->a_;
+            }
+            it.move(x->s_);
+            return n;
+        }
+
+        std::size_t drain(iterator &, T *out, std::size_t n)
+        {
+            STREAM_STATS_COUNT(expr2, fills);
+            for(std::size_t i=0; i<n; ++i) {
+                out[i] = n_.get();
+                n_.next();
+            }
+            return n;
+        }
+    private:
+        // The element goes in front before the leaves move on, as they
+        // may read it.
+        valimpl *step(const iterator &it)
+        {
+            valimpl *x = new valimpl(n_.get(), this);
+            it.slot() = x;
+            n_.next();
+            return x;
+        }
+
+        N n_;
+    };
+
+    template<typename N>
+    struct exprimpl: public impl
+    {
+        exprimpl(N &&n)
+            :n_(std::move(n)), regs_(0)
+        {
+            STREAM_STATS_NEW(expr);
+        }
+
+        ~exprimpl()
+        {
+            STREAM_STATS_DELETE(expr);
+        }
+
+        const T &get(const iterator &it)
+        {
+            STREAM_STATS_COUNT(expr, gets);
+            start(it);
+            return *it;
+        }
+
+        void next(iterator &it)
+        {
+            STREAM_STATS_COUNT(expr, nexts);
+            start(it);
+            ++it;
+        }
+
+        std::size_t fill(iterator &it, T *out, std::size_t n)
+        {
+            STREAM_STATS_COUNT(expr, fills);
+            start(it);
+            return it.slot()->fill(it, out, n);
+        }
+
+        std::size_t drain(iterator &it, T *out, std::size_t n)
+        {
+            STREAM_STATS_COUNT(expr, fills);
+            start(it);
+            return it.slot()->drain(it, out, n);
+        }
+
+        void reach(int d)
+        {
+            regs_ += d;
+            n_.reach(d);
+        }
+
+    private:
+        void start(const iterator &it)
+        {
+            reach(-regs_);
+            it.slot() = 0;
+            impl *x = new exprimpl2<N>(std::move(n_));
+            it.slot() = x;
+            delete this;
+        }
+
+        N n_;
+        int regs_;
+    };
+
+    /*
+     * The program compile() runs. Every stream object of the definition
+     * is a signal with one value per step. A prefix of n copies of init
+     * before src reads the value src had n steps ago, from a ring of src's
+     * past values; map and zip read the current values of their operands;
+     * an input steps an iterator. Signal 0 is the compiled stream.
+     */
+    struct machine
+    {
+        enum kind { past, apply1, apply2, input };
+
+        // What an apply does, as far as skip() is concerned.
+        enum linear { nonlinear, sum, difference, product, negation, identity };
+
+        // Owns a copy of an operation; call it through f1 or f2.
+        struct holder
+        {
+            virtual ~holder() {}
+        };
+
+        template<typename Op>
+        struct op: public holder
+        {
+            op(const Op &f)
+                :f_(f)
+            { }
+
+            static T call1(holder *h, const T &a)
+            {
+                return static_cast<op<Op>*>(h)->f_(a);
+            }
+
+            static T call2(holder *h, const T &a, const T &b)
+            {
+                return static_cast<op<Op>*>(h)->f_(a, b);
+            }
+
+            Op f_;
+        };
+
+        struct instr
+        {
+            kind k;
+            std::size_t out, a, b;
+            std::size_t n;
+            T init;
+            holder *h;
+            T (*f1)(holder *, const T &);
+            T (*f2)(holder *, const T &, const T &);
+            linear l;
+            iterator *it;
+        };
+
+        // Lowers the definition of s; there is nothing to run if s itself
+        // has to be read.
+        machine(const stream<T> &s)
+            :t_(0), ok_(false)
+        {
+            signal(s);
+            while(!todo_.empty()) {
+                const stream<T> *x = todo_.back();
+                todo_.pop_back();
+                if(x->impl_->lower(*this, *x))
+                    continue;
+                if(x == &s)
+                    return;
+                read(*x);
+            }
+            schedule();
+            index_.clear();
+            rests_.clear();
+            owned_.clear();
+            ok_ = true;
+        }
+
+        // Reads it as it is.
+        explicit machine(const iterator &it)
+            :t_(0), ok_(true)
+        {
+            instr x = instr();
+            x.k = input;
+            x.it = new iterator(it);
+            prog_.push_back(x);
+            vals_.resize(1);
+        }
+
+        ~machine()
+        {
+            for(instr &x : prog_) {
+                delete x.h;
+                delete x.it;
+            }
+        }
+
+        // Computes the next value of every signal.
+        void step()
+        {
+            for(instr &x : prog_) {
+                T &v = vals_[x.out];
+                switch(x.k) {
+                    case past:
+                        v = t_ < x.n ? x.init : hist_[x.a + ((t_-x.n) & x.b)];
+                        break;
+                    case apply1:
+                        v = x.f1(x.h, vals_[x.a]);
+                        break;
+                    case apply2:
+                        v = x.f2(x.h, vals_[x.a], vals_[x.b]);
+                        break;
+                    case input:
+                        v = **x.it;
+                        ++*x.it;
+                        break;
+                }
+            }
+            for(const ring &r : rings_)
+                hist_[r.at + (t_ & r.mask)] = vals_[r.sig];
+            ++t_;
+        }
+
+        const T &value() const
+        {
+            return vals_[0];
+        }
+
+        // Takes n steps at once. A stream read as it is moves on without
+        // keeping anything a forgetting stream passes.
+        void skip(std::size_t n)
+        {
+            if(prog_.size() == 1 && prog_[0].k == input) {
+                prog_[0].it->advance(n);
+                t_ += n;
+                return;
+            }
+            skip(n, std::is_arithmetic<T>());
+        }
+
+        bool ok() const
+        {
+            return ok_;
+        }
+
+        // Whether some part is read through an iterator.
+        bool reads() const
+        {
+            for(const instr &x : prog_) {
+                if(x.k == input)
+                    return true;
+            }
+            return false;
+        }
+
+        void prefix(const stream<T> &s, std::size_t n, const T &init, const stream<T> &src)
+        {
+            const std::size_t a = signal(src);
+            instr &x = at(s, past);
+            x.n = n;
+            x.init = init;
+            x.a = a;
+        }
+
+        // s is a followed by rest, the stream inside a value node, where
+        // only more values or the generator that made them can be.
+        void value(const stream<T> &s, const T &a, const stream<T> &rest)
+        {
+            prefix(s, 1, a, rest);
+            rests_.insert(&rest);
+        }
+
+        // Whether s is the rest of a value lowered before.
+        bool rest(const stream<T> &s) const
+        {
+            return rests_.count(&s) != 0;
+        }
+
+        // Whether a generator that has read src from its first element may
+        // be lowered: src has to hold that element still. An input the
+        // generator owns is read by nothing else, so it is lowered whatever
+        // it has passed.
+        bool whole(const stream<T> &src, std::true_type)
+        {
+            return !src.watch_;
+        }
+
+        bool whole(const stream<T> &src, std::false_type)
+        {
+            owned_.insert(&src);
+            return true;
+        }
+
+        bool owned(const stream<T> &s) const
+        {
+            return owned_.count(&s) != 0;
+        }
+
+        // s has the elements of src, or of signal a.
+        void same(const stream<T> &s, const stream<T> &src)
+        {
+            same(s, signal(src));
+        }
+
+        void same(const stream<T> &s, std::size_t a)
+        {
+            instr &x = at(s, apply1);
+            x.f1 = &copy;
+            x.l = identity;
+            x.a = a;
+        }
+
+        template<typename Op>
+        void map(const stream<T> &s, const Op &f, const stream<T> &src)
+        {
+            const std::size_t a = signal(src);
+            instr &x = at(s, apply1);
+            x.h = new op<Op>(f);
+            x.f1 = &op<Op>::call1;
+            x.l = linearity(f);
+            x.a = a;
+        }
+
+        template<typename Op>
+        void zip(const stream<T> &s, const Op &f, const stream<T> &src1, const stream<T> &src2)
+        {
+            const std::size_t a = signal(src1), b = signal(src2);
+            instr &x = at(s, apply2);
+            x.h = new op<Op>(f);
+            x.f2 = &op<Op>::call2;
+            x.l = linearity(f);
+            x.a = a;
+            x.b = b;
+        }
+
+        // A signal of no stream: f applied to signal a, or to a and b.
+        template<typename Op>
+        std::size_t map(const Op &f, std::size_t a)
+        {
+            instr x = instr();
+            x.k = apply1;
+            x.out = prog_.size();
+            x.h = new op<Op>(f);
+            x.f1 = &op<Op>::call1;
+            x.l = linearity(f);
+            x.a = a;
+            prog_.push_back(x);
+            return x.out;
+        }
+
+        template<typename Op>
+        std::size_t zip(const Op &f, std::size_t a, std::size_t b)
+        {
+            instr x = instr();
+            x.k = apply2;
+            x.out = prog_.size();
+            x.h = new op<Op>(f);
+            x.f2 = &op<Op>::call2;
+            x.l = linearity(f);
+            x.a = a;
+            x.b = b;
+            prog_.push_back(x);
+            return x.out;
+        }
+
+        // The signal of s, lowered later if it is new.
+        std::size_t signal(const stream<T> &s)
+        {
+            typename std::map<const stream<T>*, std::size_t>::iterator i = index_.find(&s);
+            if(i != index_.end())
+                return i->second;
+
+            const std::size_t n = prog_.size();
+            index_[&s] = n;
+            instr x = instr();
+            x.out = n;
+            prog_.push_back(x);
+            todo_.push_back(&s);
+            return n;
+        }
+
+    private:
+        struct ring
+        {
+            std::size_t sig, at, mask;
+        };
+
+        // The arithmetic of skip(): integers wrap around as unsigned ones,
+        // at least as wide as an int, instead of overflowing.
+        template<typename U, bool = std::is_integral<U>::value && !std::is_same<U, bool>::value>
+        struct arith
+        {
+            typedef U type;
+        };
+
+        template<typename U>
+        struct arith<U, true>
+        {
+            typedef typename std::common_type<unsigned, typename std::make_unsigned<U>::type>::type type;
+        };
+
+        typedef typename arith<T>::type word;
+
+        static const std::size_t npos = std::size_t(-1);
+
+        static T copy(holder *, const T &a)
+        {
+            return a;
+        }
+
+        static linear linearity(const std::plus<T> &)
+        {
+            return sum;
+        }
+
+        static linear linearity(const std::minus<T> &)
+        {
+            return difference;
+        }
+
+        static linear linearity(const std::multiplies<T> &)
+        {
+            return product;
+        }
+
+        static linear linearity(const std::negate<T> &)
+        {
+            return negation;
+        }
+
+        template<typename Op>
+        static linear linearity(const Op &)
+        {
+            return nonlinear;
+        }
+
+        void skip(std::size_t n, std::false_type)
+        {
+            for(; n; --n)
+                step();
+        }
+
+        /*
+         * Once every prefix has been passed, the rings hold the whole state
+         * and a step is a fixed map on them. When each signal is a sum of
+         * past values times constants, the map is a matrix, the companion
+         * matrix of the recurrence, and n steps are its n-th power.
+         */
+        void skip(std::size_t n, std::true_type)
+        {
+            std::size_t lead = 0;
+            for(const instr &x : prog_) {
+                if(x.k == input)
+                    lead = npos;
+                else if(x.k == past)
+                    lead = std::max(lead, x.n);
+            }
+            for(; n && t_ < lead; --n)
+                step();
+
+            std::vector<word> a;
+            if(!n || !companion(a))
+                return skip(n, std::false_type());
+
+            // State: ring entries, newest first, then the constant 1.
+            const std::size_t d = hist_.size()+1;
+            std::vector<word> w(d), p(d), b(d*d);
+            for(const ring &r : rings_) {
+                for(std::size_t j=0; j<=r.mask; ++j)
+                    w[r.at+j] = word(hist_[r.at + ((t_-1-j) & r.mask)]);
+            }
+            w[d-1] = word(1);
+
+            for(std::size_t k=n; k; k/=2) {
+                if(k & 1) {
+                    for(std::size_t i=0; i<d; ++i) {
+                        word v = word(0);
+                        for(std::size_t j=0; j<d; ++j)
+                            v += a[i*d+j] * w[j];
+                        p[i] = v;
+                    }
+                    w.swap(p);
+                }
+                if(k > 1) {
+                    for(std::size_t i=0; i<d; ++i) {
+                        for(std::size_t j=0; j<d; ++j) {
+                            word v = word(0);
+                            for(std::size_t l=0; l<d; ++l)
+                                v += a[i*d+l] * a[l*d+j];
+                            b[i*d+j] = v;
+                        }
+                    }
+                    a.swap(b);
+                }
+            }
+
+            t_ += n;
+            for(const ring &r : rings_) {
+                for(std::size_t j=0; j<=r.mask; ++j)
+                    hist_[r.at + ((t_-1-j) & r.mask)] = T(w[r.at+j]);
+            }
+        }
+
+        // The matrix of a step, if the program is linear.
+        bool companion(std::vector<word> &a)
+        {
+            const std::size_t n = prog_.size(), d = hist_.size()+1;
+            std::vector<std::size_t> src(hist_.size());
+            for(const ring &r : rings_)
+                src[r.at] = r.sig;
+
+            // Signals that never change: prefixes before a constant of the
+            // same value, and applies of constants.
+            std::vector<char> c(n, 0);
+            std::vector<T> v(n);
+            for(const instr &x : prog_) {
+                if(x.k == past) {
+                    c[x.out] = 1;
+                    v[x.out] = x.init;
+                }
+            }
+            for(bool changed = true; changed; ) {
+                changed = false;
+                for(const instr &x : prog_) {
+                    if(x.k == apply1 && (c[x.out] = c[x.a]))
+                        v[x.out] = x.f1(x.h, v[x.a]);
+                    else if(x.k == apply2 && (c[x.out] = c[x.a] && c[x.b]))
+                        v[x.out] = x.f2(x.h, v[x.a], v[x.b]);
+                }
+                for(const instr &x : prog_) {
+                    const std::size_t y = x.k == past ? src[x.a] : 0;
+                    if(x.k == past && c[x.out] && !(c[y] && v[y] == v[x.out])) {
+                        c[x.out] = 0;
+                        changed = true;
+                    }
+                }
+            }
+
+            // Each signal as a row of coefficients on the state.
+            std::vector<word> f(n*d, word(0));
+            for(const instr &x : prog_) {
+                word *y = &f[x.out*d];
+                const word *p = x.k == apply1 || x.k == apply2 ? &f[x.a*d] : 0;
+                const word *q = x.k == apply2 ? &f[x.b*d] : 0;
+                if(c[x.out]) {
+                    y[d-1] = word(v[x.out]);
+                    continue;
+                }
+                if(x.k == past) {
+                    y[x.a + x.n-1] = word(1);
+                } else if(x.k == apply1 && x.l == identity) {
+                    std::copy(p, p+d, y);
+                } else if(x.k == apply1 && x.l == negation) {
+                    for(std::size_t i=0; i<d; ++i)
+                        y[i] = word(0) - p[i];
+                } else if(x.k == apply2 && x.l == sum) {
+                    for(std::size_t i=0; i<d; ++i)
+                        y[i] = p[i] + q[i];
+                } else if(x.k == apply2 && x.l == difference) {
+                    for(std::size_t i=0; i<d; ++i)
+                        y[i] = p[i] - q[i];
+                } else if(x.k == apply2 && x.l == product && (c[x.a] || c[x.b])) {
+                    const word k = word(c[x.a] ? v[x.a] : v[x.b]);
+                    const word *r = c[x.a] ? q : p;
+                    for(std::size_t i=0; i<d; ++i)
+                        y[i] = k * r[i];
+                } else {
+                    return false;
+                }
+            }
+
+            a.assign(d*d, word(0));
+            for(const ring &r : rings_) {
+                std::copy(&f[r.sig*d], &f[r.sig*d]+d, &a[r.at*d]);
+                for(std::size_t j=1; j<=r.mask; ++j)
+                    a[(r.at+j)*d + r.at+j-1] = word(1);
+            }
+            a[d*d-1] = word(1);
+            return true;
+        }
+
+        instr &at(const stream<T> &s, kind k)
+        {
+            instr &x = prog_[index_[&s]];
+            x.k = k;
+            return x;
+        }
+
+        void read(const stream<T> &s)
+        {
+            instr &x = at(s, input);
+            x.it = new iterator(s.begin());
+        }
+
+        // Gives every signal read through a prefix a ring as long as the
+        // longest prefix before it, and puts the instructions in an order
+        // where each map and zip follows its operands. A cycle of maps and
+        // zips is a stream that needs its own current element.
+        void schedule()
+        {
+            const std::size_t n = prog_.size();
+            std::vector<std::size_t> len(n, 0);
+            for(const instr &x : prog_) {
+                if(x.k == past)
+                    len[x.a] = std::max(len[x.a], x.n);
+            }
+
+            std::vector<std::size_t> at(n);
+            for(std::size_t i=0; i<n; ++i) {
+                if(!len[i])
+                    continue;
+                std::size_t size = 1;
+                while(size < len[i])
+                    size *= 2;
+                const ring r = { i, hist_.size(), size-1 };
+                at[i] = rings_.size();
+                rings_.push_back(r);
+                hist_.resize(hist_.size()+size);
+            }
+            for(instr &x : prog_) {
+                if(x.k == past) {
+                    const ring &r = rings_[at[x.a]];
+                    x.a = r.at;
+                    x.b = r.mask;
+                }
+            }
+
+            // 0: not placed, 1: being placed, 2: placed
+            std::vector<char> state(n, 0);
+            std::vector<instr> order;
+            order.reserve(n);
+            std::vector<std::size_t> stack;
+            for(std::size_t i=0; i<n; ++i) {
+                stack.push_back(i);
+                while(!stack.empty()) {
+                    const std::size_t j = stack.back();
+                    const instr &x = prog_[j];
+                    if(state[j] == 2) {
+                        stack.pop_back();
+                        continue;
+                    }
+                    bool ready = true;
+                    if(x.k == apply1 || x.k == apply2) {
+                        state[j] = 1;
+                        const std::size_t deps[2] = { x.a, x.b };
+                        for(std::size_t d=0; d<(x.k == apply2 ? 2u : 1u); ++d) {
+                            assert(state[deps[d]] != 1);
+                            if(!state[deps[d]]) {
+                                stack.push_back(deps[d]);
+                                ready = false;
+                            }
+                        }
+                    }
+                    if(ready) {
+                        state[j] = 2;
+                        order.push_back(x);
+                        stack.pop_back();
+                    }
+                }
+            }
+            prog_.swap(order);
+            vals_.resize(n);
+        }
+
+        std::vector<instr> prog_;
+        std::vector<T> vals_;
+        std::vector<T> hist_;
+        std::vector<ring> rings_;
+        std::size_t t_;
+        bool ok_;
+
+        std::map<const stream<T>*, std::size_t> index_;
+        std::vector<const stream<T>*> todo_;
+        std::set<const stream<T>*> rests_, owned_;
+    };
+
+    // Runs a machine. g is the node the stream was defined by, if any,
+    // kept for the iterators the inputs have in it.
+    struct machineimpl: public impl
+    {
+        machineimpl(machine *m, impl *g)
+            :m_(m), g_(g)
+        {
+            STREAM_STATS_NEW(machine);
+        }
+
+        ~machineimpl()
+        {
+            STREAM_STATS_DELETE(machine);
+            delete m_;
+            delete g_;
+        }
+
+        const T &get(const iterator &it)
+        {
+            STREAM_STATS_COUNT(machine, gets);
+            return step(it)->a_;
+        }
+
+        void next(iterator &it)
+        {
+            STREAM_STATS_COUNT(machine, nexts);
+            it.move(step(it)->s_);
+        }
+
+        std::size_t fill(iterator &it, T *out, std::size_t n)
+        {
+            STREAM_STATS_COUNT(machine, fills);
+            impl **slot = &it.slot();
+            valimpl *x = 0;
+            for(std::size_t i=0; i<n; ++i) {
+                m_->step();
+                x = new valimpl(m_->value(), this);
+                *slot = x;
+                slot = &x->s_.impl_;
+                out[i] = x->a_;
+            }
+            it.move(x->s_);
+            return n;
+        }
+
+        std::size_t drain(iterator &, T *out, std::size_t n)
+        {
+            STREAM_STATS_COUNT(machine, fills);
+            for(std::size_t i=0; i<n; ++i) {
+                m_->step();
+                out[i] = m_->value();
+            }
+            return n;
+        }
+
+        // A linear program gets there by a matrix power, as in seek().
+        std::size_t skip(iterator &, std::size_t n)
+        {
+            m_->skip(n);
+            return n;
+        }
+
+    private:
+        valimpl *step(const iterator &it)
+        {
+            m_->step();
+            valimpl *x = new valimpl(m_->value(), this);
+            it.slot() = x;
+            return x;
+        }
+
+        machine *m_;
+        impl *g_;
+    };
+
+public:
+    template <typename S, typename U, typename V>
+    friend stream<U> operator <<= (U a, S && s);
+
+    // op applied to the elements of s1 and s2 side by side, or of s1. The
+    // operands may hold other types than T, as long as op gives a T.
+    template <typename Op, typename ST1, typename ST2,
+              typename = typename stream_value_type<ST1>::type,
+              typename = typename stream_value_type<ST2>::type>
+    static stream<T> zipwith(Op op, ST1 &&s1, ST2 &&s2)
+    {
+        return stream(new zipimpl<Op, decltype(s1), decltype(s2)>(op, std::forward<ST1>(s1), std::forward<ST2>(s2)));
+    }
+
+    template <typename ST1, typename Op,
+              typename = typename stream_value_type<ST1>::type>
+    static stream<T> map(Op op, ST1 &&s1)
+    {
+        return stream(new mapimpl<Op, decltype(s1)>(op, std::forward<ST1>(s1)));
+    }
 
-public:
-    typedef T value_type;
+    // The sum, least, greatest and mean of the last k elements of s up to
+    // each one, over fewer elements at the start; see windowimpl. An
+    // empty window has no elements to aggregate: k = 0 throws
+    // std::invalid_argument.
+    template <typename ST, typename = typename stream_value_type<ST>::type>
+    static stream<T> window_sum(std::size_t k, ST &&s)
+    {
+        return stream(new windowimpl<window_total, decltype(s)>(window(k), std::forward<ST>(s)));
+    }
 
-    stream(const stream<T> &o)
-        : impl_(o.impl_->clone())
+    template <typename ST, typename = typename stream_value_type<ST>::type>
+    static stream<T> window_min(std::size_t k, ST &&s)
     {
+        return stream(new windowimpl<window_first<std::less<T> >, decltype(s)>(window(k), std::forward<ST>(s)));
     }
 
-    stream(stream<T> &&o)
-        : impl_(0)
+    template <typename ST, typename = typename stream_value_type<ST>::type>
+    static stream<T> window_max(std::size_t k, ST &&s)
     {
-        std::swap(impl_, o.impl_);
+        return stream(new windowimpl<window_first<std::greater<T> >, decltype(s)>(window(k), std::forward<ST>(s)));
     }
 
-    stream<T> & operator = (stream<T> &&o)
+    template <typename ST, typename = typename stream_value_type<ST>::type>
+    static stream<T> window_mean(std::size_t k, ST &&s)
     {
-        if(this != &o) {
-            std::swap(impl_, o.impl_);
-            return *this;
-        }
+        return stream(new windowimpl<window_average, decltype(s)>(window(k), std::forward<ST>(s)));
     }
 
-    ~stream()
+    static std::size_t window(std::size_t k)
     {
-        delete impl_;
+        if(!k)
+            throw std::invalid_argument("window of no elements");
+        return k;
     }
 
-    struct iterator {
-        iterator& operator ++()
-        {
-            (*impl_)->next(*this);
-            return *this;
-        }
+    // The Cauchy product of the power series s1 and s2; see seriesimpl.
+    template <typename ST1, typename ST2,
+              typename = typename stream_value_type<ST1>::type,
+              typename = typename stream_value_type<ST2>::type>
+    static stream<T> series_mul(ST1 &&s1, ST2 &&s2)
+    {
+        return stream(new seriesimpl<decltype(s1), decltype(s2)>(std::forward<ST1>(s1), std::forward<ST2>(s2)));
+    }
 
-        const T& operator *() const
-        {
-            return (*impl_)->get(*this);
-        }
+    // init, then the running op-sum of s from init on; see scanimpl.
+    template <typename Op, typename ST1,
+              typename = typename stream_value_type<ST1>::type>
+    static stream<T> scan(Op op, const T &init, ST1 &&s1)
+    {
+        return stream(new scanimpl<Op, decltype(s1)>(op, init, std::forward<ST1>(s1)));
+    }
 
-        friend struct stream<T>;
+    // The same on the threads of stream_pool; see parallel_policy.
+    template <typename Op, typename ST1, typename ST2,
+              typename = typename stream_value_type<ST1>::type,
+              typename = typename stream_value_type<ST2>::type>
+    static stream<T> zipwith(parallel_policy, Op op, ST1 &&s1, ST2 &&s2)
+    {
+        return zipwith(parallel_op<Op>(op), std::forward<ST1>(s1), std::forward<ST2>(s2));
+    }
 
-    protected:
-        iterator(impl ** impl)
-            :impl_(impl)
-        { }
+    template <typename ST1, typename Op,
+              typename = typename stream_value_type<ST1>::type>
+    static stream<T> map(parallel_policy, Op op, ST1 &&s1)
+    {
+        return map(parallel_op<Op>(op), std::forward<ST1>(s1));
+    }
 
-        impl **impl_;
-    };
+    // k copies of init followed by s, same as k nested <<= prefixes; s
+    // itself for k = 0.
+    template <typename ST1>
+    static stream<T> delay(std::size_t k, const T& init, ST1 &&s1)
+    {
+        if(!k)
+            return stream<T>(std::forward<ST1>(s1));
+        return stream(new delayimpl<std::vector<slot>, decltype(s1)>(std::vector<slot>(k-1), init, std::forward<ST1>(s1)));
+    }
 
-    iterator begin() const
+    template <std::size_t K, typename ST1>
+    static stream<T> delay(const T& init, ST1 &&s1)
     {
-        return iterator(&impl_);
+        static_assert(K > 0, "delay needs a positive length");
+        return stream(new delayimpl<std::array<slot, K-1>, decltype(s1)>(std::array<slot, K-1>(), init, std::forward<ST1>(s1)));
     }
 
-protected:
+    /*
+     * The elements of s, computed on a thread of their own up to capacity
+     * elements ahead of the readers. The producer's thread owns s and
+     * every stream s reads: nothing else may read them while the result
+     * lives, which is asserted for the readers there are at the start, and
+     * s must not read the result. Readers that catch up with the producer
+     * sleep, or with async_wait::spin keep polling. What the producer
+     * throws is rethrown to the reader that gets to it.
+     */
+    template <typename ST1,
+              typename = typename stream_value_type<ST1>::type>
+    static stream<T> async(ST1 &&s1, std::size_t capacity = 4096,
+                           async_wait wait = async_wait::block)
+    {
+        assert(capacity > 0);
+        return stream(new asyncimpl<decltype(s1)>(std::forward<ST1>(s1), capacity, wait));
+    }
 
-    struct impl {
-        virtual ~impl() {}
-        virtual const T &get(const iterator &) = 0;
-        virtual void next(iterator &) = 0;
-        virtual impl* clone() = 0;
-    };
+#ifdef HAVE_MMAP
+    /*
+     * The elements of a binary file of Ts in native layout, mapped and
+     * paged in as the readers get to them: over and over again, or with
+     * after given, followed by after for ever. A trailing part of an
+     * element is ignored. Failing to map the file, or to cycle an empty
+     * one, throws std::system_error. The file must not change meanwhile.
+     */
+    static stream<T> from_mmap(const std::string &path)
+    {
+        static_assert(std::is_trivially_copyable<T>::value, "from_mmap needs trivially copyable elements");
+        return stream(new mmapimpl(path, 0));
+    }
 
-    mutable impl * impl_;
+    static stream<T> from_mmap(const std::string &path, const T &after)
+    {
+        static_assert(std::is_trivially_copyable<T>::value, "from_mmap needs trivially copyable elements");
+        return stream(new mmapimpl(path, &after));
+    }
+#endif
 
-    stream(impl *i)
-        :impl_(i)
-    { }
+    static stream<T> pure(const T& v)
+    {
+        stream<T> s = v<<=s;
+        return s;
+    }
 
+    /*
+     * Expression templates. expr(s) and the operators, map and zipwith
+     * applied to it build a definition as a static type instead of a graph
+     * of nodes; converting it to a stream makes one node that computes an
+     * element with a single virtual call, inlining everything but the
+     * reads of the streams it refers to.
+     */
+    // A stream read from inside an expression.
     template<typename ST>
-    struct addimpl: public impl {
-        addimpl(const T &a, ST &&s)
-            : a_(a), s_(std::forward<ST>(s))
+    struct expr_leaf
+    {
+        typedef T value_type;
+        typedef typename std::is_lvalue_reference<ST>::type by_ref;
+
+        expr_leaf(ST &&s)
+            :s_(std::forward<ST>(s)), it_(0)
         { }
 
-        const T &get(const iterator &)
-        {
-            return a_;
-        }
+        expr_leaf(const expr_leaf &o)
+            :s_(o.s_), it_(0)
+        { }
 
-        void next(iterator &it)
+        expr_leaf(expr_leaf &&o)
+            :s_(std::forward<ST>(o.s_)), it_(o.it_)
         {
-            it.impl_ = const_cast<impl**>(&s_.impl_);
+            o.it_ = 0;
         }
 
-        impl *clone()
+        ~expr_leaf()
         {
-            return new addimpl<ST>(a_, std::forward<ST>(s_));
+            delete it_;
         }
 
-    private:
-        const T a_;
-        typename storage_type<ST>::type s_;
-    };
-
-    template<typename Op, typename ST>
-    struct mapimpl2: public impl {
-        mapimpl2(Op op, ST &&s)
-            :s_(std::forward<ST>(s)),
-            it1(s_.begin()), op_(op)
+        void start()
         {
+            own(s_, by_ref());
+            it_ = new iterator(s_.begin());
         }
 
-        const T &get(const iterator &it)
+        // Elements already evaluated are read without a virtual call.
+        const T &get() const
         {
-            *(it.impl_)=new addimpl<stream<T>&&>(op_(*it1), stream<T>(this));
-            ++it1;
-            return *it;
+            impl *x = it_->slot();
+            if(typeid(*x) == typeid(valimpl))
+                return static_cast<valimpl*>(x)->a_;
+            return **it_;
         }
 
-        void next(iterator &it)
+        void next()
         {
-            *(it.impl_)=new addimpl<stream<T>&&>(op_(*it1), stream<T>(this));
-            ++it1;
-            ++it;
+            impl *x = it_->slot();
+            if(typeid(*x) == typeid(valimpl))
+                it_->move(static_cast<valimpl*>(x)->s_);
+            else
+                ++*it_;
         }
 
-        impl *clone()
+        void reach(int d)
         {
-            return new mapimpl2<Op, ST>(op_, std::forward<ST>(s_));
+            stream<T>::reach(s_, d, by_ref());
         }
     private:
         typename storage_type<ST>::type s_;
-        iterator it1;
-        Op op_;
+        iterator *it_;
     };
 
-    template<typename Op, typename ST>
-    struct mapimpl: public impl {
-        mapimpl(Op op, ST &&s)
-            : s_(std::forward<ST>(s)), op_(op)
+    template<typename N>
+    struct expr_prefix
+    {
+        typedef T value_type;
+
+        expr_prefix(const T &a, N &&n)
+            :a_(a), n_(std::move(n)), on_(false)
         { }
 
-        const T &get(const iterator &it)
-        {
-            impl *x = new mapimpl2<Op, ST>(op_, std::forward<ST>(s_));
-            *(it.impl_) = x;
+        expr_prefix(const expr_prefix &o)
+            :a_(o.a_), n_(o.n_), on_(false)
+        { }
 
-            delete this;
-            return *it;
+        expr_prefix(expr_prefix &&o)
+            :a_(std::move(o.a_)), n_(std::move(o.n_)), on_(o.on_)
+        { }
+
+        void start()
+        {
+            n_.start();
         }
 
-        void next(iterator &it)
+        T get()
         {
-            impl *x = new mapimpl2<Op, ST>(op_, std::forward<ST>(s_));
-            *(it.impl_) = x;
-            delete this;
-            ++it;
+            return on_ ? n_.get() : a_;
         }
 
-        impl *clone()
+        void next()
         {
-            return new mapimpl<Op, ST>(op_, std::forward<ST>(s_));
+            if(on_)
+                n_.next();
+            on_ = true;
         }
 
+        void reach(int d)
+        {
+            n_.reach(d);
+        }
     private:
-        typename storage_type<ST>::type s_;
-        Op op_;
+        T a_;
+        N n_;
+        bool on_;
     };
 
-    template<typename Op, typename ST1, typename ST2>
-    struct zipimpl: public impl
+    template<typename Op, typename N>
+    struct expr_map
     {
-        zipimpl(Op op, ST1 &&s1, ST2 &&s2)
-            :s1_(std::forward<ST1>(s1)), s2_(std::forward<ST2>(s2)), op_(op)
+        typedef T value_type;
+
+        expr_map(Op op, N &&n)
+            :op_(op), n_(std::move(n))
         { }
 
-        const T &get(const iterator &it)
+        void start()
         {
-            impl *x = new zipimpl2<Op, ST1, ST2>(op_, std::forward<ST1>(s1_), std::forward<ST2>(s2_));
-            *(it.impl_) = x;
-            delete this;
-            return *it;
+            n_.start();
         }
 
-        void next(iterator &it)
+        T get()
         {
-            impl *x = new zipimpl2<Op, ST1, ST2>(op_, std::forward<ST1>(s1_), std::forward<ST2>(s2_));
-            *(it.impl_) = x;
-            delete this;
-            ++it;
+            return op_(n_.get());
+        }
+
+        void next()
+        {
+            n_.next();
         }
 
-        impl *clone()
+        void reach(int d)
         {
-            return new zipimpl<Op, ST1, ST2>(op_, std::forward<ST1>(s1_), std::forward<ST2>(s2_));
+            n_.reach(d);
         }
     private:
-        typename storage_type<ST1>::type s1_;
-        typename storage_type<ST2>::type s2_;
         Op op_;
+        N n_;
     };
 
-    template<typename Op, typename ST1, typename ST2>
-    struct zipimpl2: public impl
+    template<typename Op, typename N1, typename N2>
+    struct expr_zip
     {
-        zipimpl2(Op op, ST1 &&s1, ST2 &&s2)
-            :s1_(std::forward<ST1>(s1)),s2_(std::forward<ST2>(s2)),
-            it1(s1_.begin()), it2(s2_.begin()), op_(op)
+        typedef T value_type;
+
+        expr_zip(Op op, N1 &&n1, N2 &&n2)
+            :op_(op), n1_(std::move(n1)), n2_(std::move(n2))
+        { }
+
+        void start()
         {
+            n1_.start();
+            n2_.start();
         }
 
-        const T &get(const iterator &it)
+        T get()
         {
-            *(it.impl_)=new addimpl<stream<T>&&>(op_(*it1, *it2), stream<T>(this));
-            ++it1;
-            ++it2;
-            return *it;
+            return op_(n1_.get(), n2_.get());
         }
 
-        void next(iterator &it)
+        void next()
         {
-            *(it.impl_)=new addimpl<stream<T>&&>(op_(*it1, *it2), stream<T>(this));
-            ++it1;
-            ++it2;
-            ++it;
+            n1_.next();
+            n2_.next();
         }
 
-        impl *clone()
+        void reach(int d)
         {
-            return new zipimpl2<Op, ST1, ST2>(op_, std::forward<ST1>(s1_), std::forward<ST2>(s2_));
+            n1_.reach(d);
+            n2_.reach(d);
         }
     private:
-        typename storage_type<ST1>::type s1_;
-        typename storage_type<ST2>::type s2_;
-        iterator it1, it2;
         Op op_;
+        N1 n1_;
+        N2 n2_;
     };
 
-public:
-    template <typename S, typename U>
-    friend stream<U> operator <<= (const U& a, S && s);
-
-    template <typename Op, typename ST1, typename ST2>
-    static stream<T> zipwith(Op op, ST1 &&s1, ST2 &&s2)
-    {
-        return stream(new zipimpl<Op, decltype(s1), decltype(s2)>(op, std::forward<ST1>(s1), std::forward<ST2>(s2)));
-    }
-
-    template <typename ST1, typename Op>
-    static stream<T> map(Op op, ST1 &&s1)
+    template <typename Op, typename X1, typename X2>
+    static stream_expr<expr_zip<Op, typename stream_expr_node<X1>::type,
+                                    typename stream_expr_node<X2>::type> >
+    zipwith(Op op, X1 &&s1, X2 &&s2,
+            typename stream_expr_args<X1, X2>::type * = 0)
     {
-        return stream(new mapimpl<Op, decltype(s1)>(op, std::forward<ST1>(s1)));
+        typedef expr_zip<Op, typename stream_expr_node<X1>::type,
+                             typename stream_expr_node<X2>::type> N;
+        return stream_expr<N>(N(op, stream_expr_node<X1>::make(std::forward<X1>(s1)),
+                                    stream_expr_node<X2>::make(std::forward<X2>(s2))));
     }
 
-    static stream<T> pure(const T& v)
+    template <typename X1, typename Op>
+    static stream_expr<expr_map<Op, typename stream_expr_node<X1>::type> >
+    map(Op op, X1 &&s1,
+        typename std::enable_if<is_stream_expr<typename std::decay<X1>::type>::value>::type * = 0)
     {
-        stream<T> s = v<<=s;
-        return s;
+        typedef expr_map<Op, typename stream_expr_node<X1>::type> N;
+        return stream_expr<N>(N(op, stream_expr_node<X1>::make(std::forward<X1>(s1))));
     }
 };
 
-template<typename ST>
-struct stream_value_type
+template<typename T>
+struct stream<T>::slot: public stream<T>
 {
-    typedef typename std::remove_reference<ST>::type::value_type type;
+    slot()
+        :stream<T>(static_cast<impl*>(0))
+    { }
+
+    slot(const slot &)
+        :stream<T>(static_cast<impl*>(0))
+    { }
 };
 
-template <typename S, typename U=typename stream_value_type<S>::type>
-stream<U> operator <<= (const U& a, S && s)
+template <typename S, typename U, typename = typename stream_value_type<S>::type>
+stream<U> operator <<= (U a, S && s)
+{
+    return stream<U>(new typename stream<U>::template addimpl<decltype(s)>(std::move(a), std::forward<S>(s)));
+}
+
+template<typename ST, typename T=typename stream_value_type<ST>::type>
+stream<T> delay(std::size_t k, const typename stream_value_type<ST>::type &init, ST &&s)
+{
+    return stream<T>::delay(k, init, std::forward<ST>(s));
+}
+
+template<std::size_t K, typename ST, typename T=typename stream_value_type<ST>::type>
+stream<T> delay(const typename stream_value_type<ST>::type &init, ST &&s)
+{
+    return stream<T>::template delay<K>(init, std::forward<ST>(s));
+}
+
+// A stream of R computed by op from streams of any types, R being what op
+// gives unless named: zipwith<double>(std::multiplies<double>(), ints, xs).
+template<typename R = void, typename Op, typename ST1, typename ST2,
+         typename A = typename stream_value_type<ST1>::type,
+         typename B = typename stream_value_type<ST2>::type,
+         typename T = typename stream_result<R, Op, A, B>::type>
+stream<T> zipwith(Op op, ST1 &&s1, ST2 &&s2)
+{
+    return stream<T>::zipwith(op, std::forward<ST1>(s1), std::forward<ST2>(s2));
+}
+
+template<typename R = void, typename Op, typename ST,
+         typename A = typename stream_value_type<ST>::type,
+         typename T = typename stream_result<R, Op, A>::type>
+stream<T> map(Op op, ST &&s)
 {
-    return stream<U>(new typename stream<U>::template addimpl<decltype(s)>(a, std::forward<S>(s)));
+    return stream<T>::map(op, std::forward<ST>(s));
 }
 
-template<typename ST1, typename ST2, typename T=typename stream_value_type<ST1>::type>
+template<typename R = void, typename Op, typename ST1, typename ST2,
+         typename A = typename stream_value_type<ST1>::type,
+         typename B = typename stream_value_type<ST2>::type,
+         typename T = typename stream_result<R, Op, A, B>::type>
+stream<T> zipwith(parallel_policy p, Op op, ST1 &&s1, ST2 &&s2)
+{
+    return stream<T>::zipwith(p, op, std::forward<ST1>(s1), std::forward<ST2>(s2));
+}
+
+template<typename R = void, typename Op, typename ST,
+         typename A = typename stream_value_type<ST>::type,
+         typename T = typename stream_result<R, Op, A>::type>
+stream<T> map(parallel_policy p, Op op, ST &&s)
+{
+    return stream<T>::map(p, op, std::forward<ST>(s));
+}
+
+template<typename ST1, typename ST2, typename T=typename stream_value_type<ST1>::type,
+         typename = typename stream_value_type<ST2>::type>
+stream<T> series_mul(ST1 &&s1, ST2 &&s2)
+{
+    return stream<T>::series_mul(std::forward<ST1>(s1), std::forward<ST2>(s2));
+}
+
+template<typename ST, typename T=typename stream_value_type<ST>::type>
+stream<T> window_sum(std::size_t k, ST &&s)
+{
+    return stream<T>::window_sum(k, std::forward<ST>(s));
+}
+
+template<typename ST, typename T=typename stream_value_type<ST>::type>
+stream<T> window_min(std::size_t k, ST &&s)
+{
+    return stream<T>::window_min(k, std::forward<ST>(s));
+}
+
+template<typename ST, typename T=typename stream_value_type<ST>::type>
+stream<T> window_max(std::size_t k, ST &&s)
+{
+    return stream<T>::window_max(k, std::forward<ST>(s));
+}
+
+template<typename ST, typename T=typename stream_value_type<ST>::type>
+stream<T> window_mean(std::size_t k, ST &&s)
+{
+    return stream<T>::window_mean(k, std::forward<ST>(s));
+}
+
+template<typename ST1, typename ST2, typename T=typename stream_value_type<ST1>::type,
+         typename=typename stream_value_type<ST2>::type>
 stream<T> operator +(ST1 &&s1, ST2 &&s2)
 {
     return stream<T>::zipwith(std::plus<T>(), std::forward<ST1>(s1), std::forward<ST2>(s2));
 }
 
-template<typename ST1, typename ST2, typename T=typename stream_value_type<ST1>::type>
+template<typename ST1, typename ST2, typename T=typename stream_value_type<ST1>::type,
+         typename=typename stream_value_type<ST2>::type>
 stream<T> operator -(ST1 &&s1, ST2 &&s2)
 {
     return stream<T>::zipwith(std::minus<T>(), std::forward<ST1>(s1), std::forward<ST2>(s2));
 }
 
-template<typename ST1, typename ST2, typename T=typename stream_value_type<ST1>::type>
+template<typename ST1, typename ST2, typename T=typename stream_value_type<ST1>::type,
+         typename=typename stream_value_type<ST2>::type>
 stream<T> operator *(ST1 &&s1, ST2 &&s2)
 {
     return stream<T>::zipwith(std::multiplies<T>(), std::forward<ST1>(s1), std::forward<ST2>(s2));
 }
 
-template<typename ST1, typename ST2, typename T=typename stream_value_type<ST1>::type>
+template<typename ST1, typename ST2, typename T=typename stream_value_type<ST1>::type,
+         typename=typename stream_value_type<ST2>::type>
 stream<T> operator /(ST1 &&s1, ST2 &&s2)
 {
     return stream<T>::zipwith(std::divides<T>(), std::forward<ST1>(s1), std::forward<ST2>(s2));
 }
 
-template<typename ST1, typename ST2, typename T=typename stream_value_type<ST1>::type>
+template<typename ST1, typename ST2, typename T=typename stream_value_type<ST1>::type,
+         typename=typename stream_value_type<ST2>::type>
 stream<T> operator %(ST1 &&s1, ST2 &&s2)
 {
     return stream<T>::zipwith(std::modulus<T>(), std::forward<ST1>(s1), std::forward<ST2>(s2));
@@ -355,6 +6252,155 @@ stream<T> operator -(ST &&s)
     return stream<T>::map(std::negate<T>(), std::forward<ST>(s));
 }
 
+/*
+ * What expr(s) and the operators on it return: a stream definition whose
+ * shape is part of its type. Converting it to a stream compiles it into
+ * a single node.
+ */
+template<typename N>
+struct stream_expr
+{
+    typedef typename N::value_type value_type;
+
+    explicit stream_expr(N &&n)
+        : node_(std::move(n))
+    { }
+
+    N node_;
+};
+
+template<typename N>
+struct is_stream_expr<stream_expr<N> >: std::true_type
+{ };
+
+template<typename N>
+struct stream_expr_node<stream_expr<N> >
+{
+    typedef N type;
+
+    static N make(stream_expr<N> &&e)
+    {
+        return std::move(e.node_);
+    }
+};
+
+template<typename N>
+struct stream_expr_node<stream_expr<N> &>
+{
+    typedef N type;
+
+    static N make(const stream_expr<N> &e)
+    {
+        return e.node_;
+    }
+};
+
+template<typename N>
+struct stream_expr_node<const stream_expr<N> &>: stream_expr_node<stream_expr<N> &>
+{ };
+
+template<typename T>
+struct stream_expr_node<stream<T> >
+{
+    typedef typename stream<T>::template expr_leaf<stream<T> &&> type;
+
+    static type make(stream<T> &&s)
+    {
+        return type(std::move(s));
+    }
+};
+
+template<typename T>
+struct stream_expr_node<stream<T> &>
+{
+    typedef typename stream<T>::template expr_leaf<stream<T> &> type;
+
+    static type make(stream<T> &s)
+    {
+        return type(s);
+    }
+};
+
+template<typename T>
+struct stream_expr_node<const stream<T> &>
+{
+    typedef typename stream<T>::template expr_leaf<const stream<T> &> type;
+
+    static type make(const stream<T> &s)
+    {
+        return type(s);
+    }
+};
+
+// Operands of a binary operator on expressions: one of them is one, the
+// other one may be a stream with the same element type.
+template<typename X1, typename X2>
+struct stream_expr_args<X1, X2, typename std::enable_if<
+    (is_stream_expr<typename std::decay<X1>::type>::value ||
+     is_stream_expr<typename std::decay<X2>::type>::value) &&
+    std::is_same<typename stream_expr_node<X1>::type::value_type,
+                 typename stream_expr_node<X2>::type::value_type>::value>::type>
+{
+    typedef typename stream_expr_node<X1>::type::value_type type;
+};
+
+template<typename ST, typename T=typename stream_value_type<ST>::type>
+stream_expr<typename stream_expr_node<ST>::type> expr(ST &&s)
+{
+    return stream_expr<typename stream_expr_node<ST>::type>(
+        stream_expr_node<ST>::make(std::forward<ST>(s)));
+}
+
+template<typename N, typename T=typename N::value_type>
+stream_expr<typename stream<T>::template expr_prefix<N> >
+operator <<= (const typename N::value_type &a, stream_expr<N> e)
+{
+    typedef typename stream<T>::template expr_prefix<N> P;
+    return stream_expr<P>(P(a, std::move(e.node_)));
+}
+
+template<typename X1, typename X2, typename T=typename stream_expr_args<X1, X2>::type>
+auto operator +(X1 &&s1, X2 &&s2)
+    -> decltype(stream<T>::zipwith(std::plus<T>(), std::forward<X1>(s1), std::forward<X2>(s2)))
+{
+    return stream<T>::zipwith(std::plus<T>(), std::forward<X1>(s1), std::forward<X2>(s2));
+}
+
+template<typename X1, typename X2, typename T=typename stream_expr_args<X1, X2>::type>
+auto operator -(X1 &&s1, X2 &&s2)
+    -> decltype(stream<T>::zipwith(std::minus<T>(), std::forward<X1>(s1), std::forward<X2>(s2)))
+{
+    return stream<T>::zipwith(std::minus<T>(), std::forward<X1>(s1), std::forward<X2>(s2));
+}
+
+template<typename X1, typename X2, typename T=typename stream_expr_args<X1, X2>::type>
+auto operator *(X1 &&s1, X2 &&s2)
+    -> decltype(stream<T>::zipwith(std::multiplies<T>(), std::forward<X1>(s1), std::forward<X2>(s2)))
+{
+    return stream<T>::zipwith(std::multiplies<T>(), std::forward<X1>(s1), std::forward<X2>(s2));
+}
+
+template<typename X1, typename X2, typename T=typename stream_expr_args<X1, X2>::type>
+auto operator /(X1 &&s1, X2 &&s2)
+    -> decltype(stream<T>::zipwith(std::divides<T>(), std::forward<X1>(s1), std::forward<X2>(s2)))
+{
+    return stream<T>::zipwith(std::divides<T>(), std::forward<X1>(s1), std::forward<X2>(s2));
+}
+
+template<typename X1, typename X2, typename T=typename stream_expr_args<X1, X2>::type>
+auto operator %(X1 &&s1, X2 &&s2)
+    -> decltype(stream<T>::zipwith(std::modulus<T>(), std::forward<X1>(s1), std::forward<X2>(s2)))
+{
+    return stream<T>::zipwith(std::modulus<T>(), std::forward<X1>(s1), std::forward<X2>(s2));
+}
+
+template<typename N, typename T=typename N::value_type>
+auto operator -(stream_expr<N> e)
+    -> decltype(stream<T>::map(std::negate<T>(), std::move(e)))
+{
+    return stream<T>::map(std::negate<T>(), std::move(e));
+}
+
 #ifdef HAVE_LITERALS
 
 struct stream_proxy
@@ -1,215 +1,147 @@
-#include <utility>
-#include <type_traits>
-#include <iostream>
-#include <functional>
-#include <list>
-
-template<typename T> class stream;
-template<typename T> class stream_impl;
-template<typename T> class stream_iterator_impl;
-template<typename T> class iterator_temp;
-
-template <typename T>
-using storage_type = typename std::conditional<
-        std::is_rvalue_reference<T>::value,
-        typename std::remove_reference<T>::type,
-        T
-    >;
-
-template<typename T>
-class is_stream : public std::integral_constant<bool, false>
-{};
-
-template<typename T>
-class is_stream<stream<T>> : public std::integral_constant<bool, true>
-{};
-
-template<typename T>
-class stream
+/*
+ * Copyright (c) 2011-2012, Attila Gobi and Zalan Szugyi
+ * All rights reserved.
+ *
+ * This software was developed by Attila Gobi and Zalan Szugyi.
+ * The project was supported by the European Union and co-financed by the
+ * European Social Fund (grant agreement no. TAMOP 4.2.1./B-09/1/KMR-2010-0003)
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "stream.h"
+#include "stream2.h"
+#include <cassert>
+#include <chrono>
+
+/*
+ * The definitions of test_fibonacci, test_change and test_override, on
+ * either backend: S is ::stream or stream2::stream. Checks that both give
+ * the same elements, and prints how long each takes per element.
+ */
+
+template<typename ST>
+void check(const ST &s, const std::initializer_list<typename ST::value_type> &a)
 {
-public:
-    typedef T value_type;
-
-    stream(stream &) = delete;
-    stream(stream &&s): _impl(0)
-    {
-        std::swap(_impl, s._impl);
-    }
-
-    stream(stream_impl<T> * impl)
-        : _impl(impl)
-    {}
-
-    ~stream()
-    {
-        delete _impl;
+    typename ST::iterator it = s.begin();
+    for(const typename ST::value_type &x : a) {
+        assert(*it == x);
+        ++it;
     }
+}
 
-    struct iterator
-    {
-        iterator()
-            : _tmp(new iterator_temp<T>(*this))
-        {}
-
-        iterator(iterator &) = delete;
-        iterator(iterator &&rhs)
-        {
-            std::swap(_its, rhs._its);
-            std::swap(_tmp, rhs._tmp);
-        }
-
-        iterator &
-        operator = (iterator &&rhs)
-        {
-            std::swap(_its, rhs._its);
-            return *this;
-        }
-
-        iterator &operator ++ ()
-        {
-            _tmp->step();
-            for(std::unique_ptr<stream_iterator_impl<T>> &p : _its)
-                p->step();
-
-            return *this;
-        }
-
-        const T& operator *()
-        {
-            return _its.front()->value();
-        }
-
-        std::list<std::unique_ptr<stream_iterator_impl<T>>> _its;
-        std::unique_ptr<stream_iterator_impl<T>> _tmp;
-    };
-
-    iterator begin()
-    {
-        iterator it;
-        _impl->build(it);
-        return it;
-    }
-
-private:
-    stream_impl<T> * _impl;
-};
-
-template <typename T>
-class stream_iterator_impl
-{
-public:
-    inline stream_iterator_impl() {}
-    inline virtual ~stream_iterator_impl() {}
-    stream_iterator_impl(stream_iterator_impl&) = delete;
-    stream_iterator_impl(stream_iterator_impl&&) = delete;
-    virtual void step() = 0;
-    virtual const T & value() = 0;
-};
-
-template <typename T>
-class stream_impl
-{
-public:
-    inline stream_impl() {}
-    stream_impl(stream_impl&) = delete;
-    stream_impl(stream_impl&&) = delete;
-    inline virtual ~stream_impl() {}
-    virtual void build(typename stream<T>::iterator &) = 0;
-};
-
-template<typename T>
-class iterator_temp: public stream_iterator_impl<T>
+// Nanoseconds per element stepping through n elements of s; the last
+// element goes to last.
+template<typename ST>
+double run(const ST &s, int n, typename ST::value_type &last)
 {
-public:
-    iterator_temp(typename stream<T>::iterator& s): _s(s) {}
-    virtual void step() { _value = *_s; }
-    virtual const T & value() { return _value; };
-    typename stream<T>::iterator &_s;
-    T _value;
-};
+    std::chrono::steady_clock::time_point t = std::chrono::steady_clock::now();
+    typename ST::iterator it = s.begin();
+    for(int i=0; i<n; ++i)
+        ++it;
+    last = *it;
+    std::chrono::duration<double, std::nano> d = std::chrono::steady_clock::now() - t;
+    return d.count() / n;
+}
 
-template<typename S>
-class cons_impl : public stream_iterator_impl<S>
+template<template<typename> class S>
+struct fibonacci
 {
-public:
-    typedef typename std::remove_reference<S>::type::value_type value_type;
+    S<long> f;
 
-    cons_impl(const value_type & i, S && s)
-        : _x(i), _xs(std::forward<S>(s))
+    fibonacci()
+        :f(0l<<=f+(1l<<=f))
     {}
-
-private:
-    value_type _x;
-    typename storage_type<S>::type _xs;
-
-    void build(typename stream<value_type>::iterator &)
-    {
-
-    }
 };
 
-template<typename S>
-class cons : public stream_impl<typename std::remove_reference<S>::type::value_type>
+template<template<typename> class S, typename ST>
+S<long> times(long n, long val, ST && s)
 {
-public:
-    typedef typename std::remove_reference<S>::type::value_type value_type;
+    if(n==1)
+        return val<<=std::forward<ST>(s);
+    return times<S>(n-1, val, val<<=std::forward<ST>(s));
+}
 
-    cons(const value_type & i, S && s)
-        : _x(i), _xs(std::forward<S>(s))
+template<template<typename> class S>
+struct change
+{
+    S<long> c1, c2, c5, c10, c20, c50;
+
+    change()
+        :c1(1l<<=c1),
+        c2(times<S>(2, 0, c2) + c1),
+        c5(times<S>(5, 0, c5) + c2),
+        c10(times<S>(10, 0, c10) + c5),
+        c20(times<S>(20, 0, c20) + c10),
+        c50(times<S>(50, 0, c50) + c20)
     {}
-
-private:
-    value_type _x;
-    typename storage_type<S>::type _xs;
-
-    void build(typename stream<value_type>::iterator &)
-    {
-
-    }
 };
 
-template<typename T, typename std::enable_if<is_stream<typename std::remove_reference<T>::type>::value>::type* = nullptr>
-typename std::remove_reference<T>::type operator <<= (typename std::remove_reference<T>::type::value_type i, T && s)
-{
-    return new cons<T>(i, std::forward<T>(s));
-}
-
-template<typename S, typename T, typename OP>
-class binop : public stream_impl<typename std::remove_reference<S>::type::value_type>
+template<template<typename> class S>
+struct override
 {
-public:
-    typedef typename std::remove_reference<S>::type::value_type value_type;
+    S<double> s1, s2;
+    S<int> s3, s4, pm;
 
-    binop(S && lhs, T && rhs): _lhs(std::forward<S>(lhs)), _rhs(std::forward<T>(rhs))
+    override()
+        :s1(1.0<<=s2), s2(.0<<=s1), s3(1<<=s3), s4(s3+s3), pm(1<<=(-pm))
     {}
-
-    void build(typename stream<value_type>::iterator &)
-    {
-    }
-private:
-    typename storage_type<S>::type _lhs;
-    typename storage_type<T>::type _rhs;
 };
 
-template<typename S, typename T, typename std::enable_if<is_stream<typename std::remove_reference<T>::type>::value>::type* = nullptr>
-typename std::remove_reference<T>::type operator + (T && lhs, S && rhs)
+template<template<typename> class S>
+void test()
 {
-    return new binop<S, T, std::plus<typename std::remove_reference<T>::type::value_type>>(std::forward<S>(lhs), std::forward<T>(rhs));
+    fibonacci<S> f;
+    check(f.f, {0l,1l,1l,2l,3l,5l,8l,13l,21l,34l});
+
+    change<S> c;
+    check(c.c10, {1l,1l,2l,2l,3l,4l,5l,6l,7l,8l,11l,12l});
+
+    override<S> o;
+    check(o.s1, {1., 0., 1., 0.});
+    check(o.s2, {0., 1., 0., 1.});
+    check(o.s3, {1, 1, 1});
+    check(o.s4, {2, 2, 2});
+    check(o.pm, {1, -1, 1, -1});
 }
 
 int main()
 {
-    stream<int> zeroes = 0 <<= zeroes;
-    stream<int> ones = 1 <<= ones;
-    stream<int> zo = 0 <<= 1 <<= zo;
-    stream<int> increment = 0 <<= ones + increment;
-//    stream<int> sums = 0 <<= sums + std::cin;
-
-    stream<int>::iterator it = zeroes.begin();
-    for(int i=0; i<100; ++i, ++it)
-        std::cout<<*it<<std::endl;
-
-    it = increment.begin();
-    for(int i=0; i<100; ++i, ++it)
-        std::cout<<*it<<std::endl;
+    test<stream>();
+    test<stream2::stream>();
+
+    const int n = 1000000;
+    long a, b;
+
+    fibonacci<stream> f1;
+    fibonacci<stream2::stream> f2;
+    const double t1 = run(f1.f, n, a);
+    const double t2 = run(f2.f, n, b);
+    assert(a == b);
+    std::cout<<"fibonacci: stream.h "<<t1<<" ns/element, stream2.h "<<t2<<" ns/element"<<std::endl;
+
+    change<stream> c1;
+    change<stream2::stream> c2;
+    const double t3 = run(c1.c50, n, a);
+    const double t4 = run(c2.c50, n, b);
+    assert(a == b);
+    std::cout<<"change: stream.h "<<t3<<" ns/element, stream2.h "<<t4<<" ns/element"<<std::endl;
+
+    return 0;
 }
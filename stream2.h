@@ -0,0 +1,449 @@
+/*
+ * Copyright (c) 2011-2012, Attila Gobi and Zalan Szugyi
+ * All rights reserved.
+ *
+ * This software was developed by Attila Gobi and Zalan Szugyi.
+ * The project was supported by the European Union and co-financed by the
+ * European Social Fund (grant agreement no. TAMOP 4.2.1./B-09/1/KMR-2010-0003)
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __stream2_h__
+#define __stream2_h__
+
+/*
+ * A second engine for the same definitions. Instead of memoizing every
+ * element in a node, begin() builds one step object per stream the
+ * definition reaches, and ++ steps all of them in lockstep: a prefix
+ * (cons) latches the value its rest had one step before, an operation
+ * (binop, unop) recomputes from its operands. An iterator costs as much
+ * memory as the definition and nothing per element; iterators do not
+ * share anything, so each one computes the elements again.
+ *
+ * Streams can not be copied, only moved, and refer to the streams they
+ * are defined by by name, as in stream.h.
+ */
+
+#include <utility>
+#include <type_traits>
+#include <functional>
+#include <memory>
+#include <vector>
+#include <map>
+#include <cassert>
+
+namespace stream2
+{
+
+template<typename T> class stream;
+template<typename T> class stream_impl;
+template<typename T> class stream_iterator_impl;
+
+template <typename T>
+using storage_type = typename std::conditional<
+        std::is_rvalue_reference<T>::value,
+        typename std::remove_reference<T>::type,
+        T
+    >;
+
+template<typename T>
+class is_stream : public std::integral_constant<bool, false>
+{};
+
+template<typename T>
+class is_stream<stream<T>> : public std::integral_constant<bool, true>
+{};
+
+template<typename T>
+using value_type_of = typename std::remove_reference<T>::type::value_type;
+
+template<typename T>
+class stream
+{
+public:
+    typedef T value_type;
+
+    stream(stream &) = delete;
+    stream(stream &&s): _impl(0)
+    {
+        std::swap(_impl, s._impl);
+    }
+
+    stream(stream_impl<T> * impl)
+        : _impl(impl)
+    {}
+
+    ~stream()
+    {
+        delete _impl;
+    }
+
+    struct iterator
+    {
+        iterator()
+            : _front(0)
+        {}
+
+        iterator(iterator &) = delete;
+        iterator(iterator &&rhs)
+            : _front(0)
+        {
+            swap(rhs);
+        }
+
+        iterator &
+        operator = (iterator &&rhs)
+        {
+            swap(rhs);
+            return *this;
+        }
+
+        // Every prefix latches the old value of its rest before any of
+        // them takes the new one, then the operations follow their
+        // operands.
+        iterator &operator ++ ()
+        {
+            for(stream_iterator_impl<T> *p : _regs)
+                p->latch();
+            for(stream_iterator_impl<T> *p : _regs)
+                p->step();
+            for(stream_iterator_impl<T> *p : _ops)
+                p->step();
+
+            return *this;
+        }
+
+        const T& operator *() const
+        {
+            return _front->value();
+        }
+
+        // The step object of s in this iterator; a stream reached again
+        // through a recursive definition gets the one already built.
+        stream_iterator_impl<T> *node(const stream<T> &s)
+        {
+            typename std::map<const stream_impl<T>*, stream_iterator_impl<T>*>::iterator i =
+                _nodes.find(s._impl);
+            if(i != _nodes.end()) {
+                // An operation that reads itself without a prefix between
+                assert(i->second);
+                return i->second;
+            }
+            return s._impl->build(*this);
+        }
+
+        // Prefixes are registers, stepped before the operations.
+        stream_iterator_impl<T> *add(const stream_impl<T> *s, stream_iterator_impl<T> *p, bool reg)
+        {
+            _its.emplace_back(p);
+            (reg ? _regs : _ops).push_back(p);
+            _nodes[s] = p;
+            return p;
+        }
+
+        // Marks s as being built, so that a loop through operations only
+        // is caught.
+        void enter(const stream_impl<T> *s)
+        {
+            _nodes[s] = 0;
+        }
+
+        // A prefix reads its rest only from the next step on, so the rest
+        // may be an operation still being built: it is looked up once the
+        // building is over.
+        void defer(stream_iterator_impl<T> **p, const stream<T> &s)
+        {
+            _later.push_back(std::make_pair(p, &s));
+        }
+
+        friend class stream<T>;
+
+    private:
+        void swap(iterator &rhs)
+        {
+            std::swap(_its, rhs._its);
+            std::swap(_regs, rhs._regs);
+            std::swap(_ops, rhs._ops);
+            std::swap(_nodes, rhs._nodes);
+            std::swap(_later, rhs._later);
+            std::swap(_front, rhs._front);
+        }
+
+        std::vector<std::unique_ptr<stream_iterator_impl<T>>> _its;
+        std::vector<stream_iterator_impl<T>*> _regs;
+        std::vector<stream_iterator_impl<T>*> _ops;
+        std::map<const stream_impl<T>*, stream_iterator_impl<T>*> _nodes;
+        std::vector<std::pair<stream_iterator_impl<T>**, const stream<T>*>> _later;
+        stream_iterator_impl<T> *_front;
+    };
+
+    iterator begin() const
+    {
+        iterator it;
+        it._front = it.node(*this);
+        while(!it._later.empty()) {
+            std::pair<stream_iterator_impl<T>**, const stream<T>*> x = it._later.back();
+            it._later.pop_back();
+            *x.first = it.node(*x.second);
+        }
+        for(stream_iterator_impl<T> *p : it._ops)
+            p->step();
+        it._nodes.clear();
+        return it;
+    }
+
+private:
+    template<typename S> friend class cons;
+
+    stream_impl<T> * _impl;
+};
+
+template <typename T>
+class stream_iterator_impl
+{
+public:
+    inline stream_iterator_impl() {}
+    inline virtual ~stream_iterator_impl() {}
+    stream_iterator_impl(stream_iterator_impl&) = delete;
+    stream_iterator_impl(stream_iterator_impl&&) = delete;
+    virtual void latch() {}
+    virtual void step() = 0;
+
+    const T & value() const
+    {
+        return _value;
+    }
+
+protected:
+    T _value;
+};
+
+template <typename T>
+class stream_impl
+{
+public:
+    inline stream_impl() {}
+    stream_impl(stream_impl&) = delete;
+    stream_impl(stream_impl&&) = delete;
+    inline virtual ~stream_impl() {}
+    virtual stream_iterator_impl<T> *build(typename stream<T>::iterator &) = 0;
+
+    // A prefix appends its element and returns the stream after it.
+    virtual const stream<T> *chain(std::vector<T> &) { return 0; }
+};
+
+template<typename T>
+class cons_impl : public stream_iterator_impl<T>
+{
+public:
+    cons_impl(const T & x)
+        : _next(x), _xs(0)
+    {}
+
+    virtual void latch() { _next = _xs->value(); }
+    virtual void step() { this->_value = _next; }
+
+    T _next;
+    stream_iterator_impl<T> *_xs;
+};
+
+// A run of k prefixes owned by each other, as one ring of the last k
+// elements of the rest.
+template<typename T>
+class prefix_impl : public stream_iterator_impl<T>
+{
+public:
+    prefix_impl(std::vector<T> && xs)
+        : _buf(std::move(xs)), _pos(0), _xs(0)
+    {
+        this->_value = _buf[0];
+    }
+
+    virtual void latch() { _next = _xs->value(); }
+
+    virtual void step()
+    {
+        _buf[_pos] = _next;
+        if(++_pos == _buf.size())
+            _pos = 0;
+        this->_value = _buf[_pos];
+    }
+
+    std::vector<T> _buf;
+    std::size_t _pos;
+    T _next;
+    stream_iterator_impl<T> *_xs;
+};
+
+template<typename S>
+class cons : public stream_impl<value_type_of<S>>
+{
+public:
+    typedef value_type_of<S> value_type;
+
+    cons(const value_type & i, S && s)
+        : _x(i), _xs(std::forward<S>(s))
+    {}
+
+private:
+    value_type _x;
+    typename storage_type<S>::type _xs;
+
+    stream_iterator_impl<value_type> *build(typename stream<value_type>::iterator &it)
+    {
+        std::vector<value_type> xs;
+        const stream<value_type> *rest = chain(xs);
+        if(xs.size() > 1) {
+            prefix_impl<value_type> *p = new prefix_impl<value_type>(std::move(xs));
+            it.add(this, p, true);
+            it.defer(&p->_xs, *rest);
+            return p;
+        }
+
+        cons_impl<value_type> *p = new cons_impl<value_type>(_x);
+        it.add(this, p, true);
+        p->step();
+        it.defer(&p->_xs, _xs);
+        return p;
+    }
+
+    // Nobody else reads a rest held by value, so it joins the run.
+    const stream<value_type> *chain(std::vector<value_type> &xs)
+    {
+        xs.push_back(_x);
+        const stream<value_type> *rest = 0;
+        if(!std::is_lvalue_reference<S>::value)
+            rest = _xs._impl->chain(xs);
+        return rest ? rest : &_xs;
+    }
+};
+
+template<typename T, typename std::enable_if<is_stream<typename std::remove_reference<T>::type>::value>::type* = nullptr>
+typename std::remove_reference<T>::type operator <<= (value_type_of<T> i, T && s)
+{
+    return new cons<T>(i, std::forward<T>(s));
+}
+
+template<typename T, typename OP>
+class binop_impl : public stream_iterator_impl<T>
+{
+public:
+    binop_impl(const stream_iterator_impl<T> *lhs, const stream_iterator_impl<T> *rhs)
+        : _lhs(lhs), _rhs(rhs)
+    {}
+
+    virtual void step() { this->_value = OP()(_lhs->value(), _rhs->value()); }
+
+private:
+    const stream_iterator_impl<T> *_lhs;
+    const stream_iterator_impl<T> *_rhs;
+};
+
+template<typename S, typename T, typename OP>
+class binop : public stream_impl<value_type_of<S>>
+{
+public:
+    typedef value_type_of<S> value_type;
+
+    binop(S && lhs, T && rhs): _lhs(std::forward<S>(lhs)), _rhs(std::forward<T>(rhs))
+    {}
+
+    stream_iterator_impl<value_type> *build(typename stream<value_type>::iterator &it)
+    {
+        it.enter(this);
+        stream_iterator_impl<value_type> *l = it.node(_lhs);
+        stream_iterator_impl<value_type> *r = it.node(_rhs);
+        return it.add(this, new binop_impl<value_type, OP>(l, r), false);
+    }
+
+private:
+    typename storage_type<S>::type _lhs;
+    typename storage_type<T>::type _rhs;
+};
+
+template<typename T, typename OP>
+class unop_impl : public stream_iterator_impl<T>
+{
+public:
+    unop_impl(const stream_iterator_impl<T> *s)
+        : _s(s)
+    {}
+
+    virtual void step() { this->_value = OP()(_s->value()); }
+
+private:
+    const stream_iterator_impl<T> *_s;
+};
+
+template<typename S, typename OP>
+class unop : public stream_impl<value_type_of<S>>
+{
+public:
+    typedef value_type_of<S> value_type;
+
+    unop(S && s): _s(std::forward<S>(s))
+    {}
+
+    stream_iterator_impl<value_type> *build(typename stream<value_type>::iterator &it)
+    {
+        it.enter(this);
+        stream_iterator_impl<value_type> *s = it.node(_s);
+        return it.add(this, new unop_impl<value_type, OP>(s), false);
+    }
+
+private:
+    typename storage_type<S>::type _s;
+};
+
+template<typename S, typename T>
+using enable_binop = typename std::enable_if<
+        is_stream<typename std::remove_reference<S>::type>::value &&
+        std::is_same<typename std::remove_reference<S>::type,
+                     typename std::remove_reference<T>::type>::value
+    >::type;
+
+template<typename S, typename T, enable_binop<S, T>* = nullptr>
+typename std::remove_reference<S>::type operator + (S && lhs, T && rhs)
+{
+    return new binop<S, T, std::plus<value_type_of<S>>>(std::forward<S>(lhs), std::forward<T>(rhs));
+}
+
+template<typename S, typename T, enable_binop<S, T>* = nullptr>
+typename std::remove_reference<S>::type operator - (S && lhs, T && rhs)
+{
+    return new binop<S, T, std::minus<value_type_of<S>>>(std::forward<S>(lhs), std::forward<T>(rhs));
+}
+
+template<typename S, typename T, enable_binop<S, T>* = nullptr>
+typename std::remove_reference<S>::type operator * (S && lhs, T && rhs)
+{
+    return new binop<S, T, std::multiplies<value_type_of<S>>>(std::forward<S>(lhs), std::forward<T>(rhs));
+}
+
+template<typename S, typename std::enable_if<is_stream<typename std::remove_reference<S>::type>::value>::type* = nullptr>
+typename std::remove_reference<S>::type operator - (S && s)
+{
+    return new unop<S, std::negate<value_type_of<S>>>(std::forward<S>(s));
+}
+
+}
+
+#endif//__stream2_h__
@@ -0,0 +1,130 @@
+/*
+ * Copyright (c) 2011-2012, Attila Gobi and Zalan Szugyi
+ * All rights reserved.
+ *
+ * This software was developed by Attila Gobi and Zalan Szugyi.
+ * The project was supported by the European Union and co-financed by the
+ * European Social Fund (grant agreement no. TAMOP 4.2.1./B-09/1/KMR-2010-0003)
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "stream.h"
+#include "test_common.h"
+
+// Squares, counting how often it runs.
+struct square
+{
+    long operator()(long x) const
+    {
+        ++calls;
+        return x*x;
+    }
+
+    static long calls;
+};
+
+long square::calls = 0;
+
+struct product
+{
+    long operator()(long x, long y) const
+    {
+        ++square::calls;
+        return x*y;
+    }
+};
+
+// Fibonacci numbers by doubling, modulo 2^64.
+void fib(unsigned long n, unsigned long &a, unsigned long &b)
+{
+    if(!n) {
+        a = 0;
+        b = 1;
+        return;
+    }
+    unsigned long c, d;
+    fib(n/2, c, d);
+    const unsigned long e = c*(2*d-c), f = c*c+d*d;
+    a = n&1 ? f : e;
+    b = n&1 ? e+f : f;
+}
+
+int main()
+{
+    stream<long> one = 1l<<=one;
+    stream<long> nat = 0l<<=nat+one;
+
+    // Nobody else reads the squares: only the last one is computed.
+    stream<long> sq = stream<long>::map(square(), nat);
+    sq.forget();
+    stream<long>::iterator it = sq.begin();
+    it.advance(1000);
+    assert(*it == 1000000);
+    assert(square::calls == 1);
+    it.advance(0);
+    it.advance(10);
+    assert(*it == 1010l*1010l);
+    assert(square::calls == 2);
+
+    // The same for zips and fused operations.
+    square::calls = 0;
+    stream<long> pr = stream<long>::zipwith(product(), nat, nat+one);
+    pr.forget();
+    stream<long>::iterator pit = pr.begin();
+    pit.advance(100);
+    assert(*pit == 100*101);
+    stream<long> fu = stream<long>::map(square(), stream<long>::map(square(), nat));
+    fu.forget();
+    stream<long>::iterator fit = fu.begin();
+    fit.advance(30);
+    assert(*fit == 30l*30*30*30);
+    assert(square::calls == 3);
+
+    // Elements others can read are kept.
+    square::calls = 0;
+    stream<long> kept = stream<long>::map(square(), nat);
+    stream<long>::iterator kit = kept.begin();
+    kit.advance(5);
+    assert(*kit == 25);
+    assert(square::calls == 6);
+    compare(kept, {0l, 1l, 4l, 9l, 16l, 25l}, 1);
+
+    // Recursive definitions compute the history they need.
+    stream<long> f = 0l<<=f+(1l<<=f);
+    f.forget();
+    stream<long>::iterator ft = f.begin();
+    ft.advance(90);
+    unsigned long a, b;
+    fib(90, a, b);
+    assert(*ft == long(a));
+
+    // A compiled linear recurrence skips by a matrix power.
+    stream<unsigned long> h = 0ul<<=h+(1ul<<=h);
+    h.compile();
+    h.forget();
+    stream<unsigned long>::iterator ht = h.begin();
+    ht.advance(1000000000000ul);
+    fib(1000000000000ul, a, b);
+    assert(*ht == a);
+    ++ht;
+    assert(*ht == b);
+    return 0;
+}
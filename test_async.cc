@@ -0,0 +1,164 @@
+/*
+ * Copyright (c) 2011-2012, Attila Gobi and Zalan Szugyi
+ * All rights reserved.
+ *
+ * This software was developed by Attila Gobi and Zalan Szugyi.
+ * The project was supported by the European Union and co-financed by the
+ * European Social Fund (grant agreement no. TAMOP 4.2.1./B-09/1/KMR-2010-0003)
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "stream.h"
+#include "test_common.h"
+#include <chrono>
+#include <stdexcept>
+
+// Burns about the same time on either side of the ring.
+struct slow
+{
+    long operator()(long x) const
+    {
+        volatile long y = x;
+        for(int i=0; i<2000; ++i)
+            y = y + 1;
+        return y - 2000;
+    }
+};
+
+// No default constructor, so the ring cannot make any ahead.
+struct bare
+{
+    explicit bare(long v)
+        :v(v)
+    { }
+
+    long v;
+};
+
+struct inc
+{
+    bare operator()(const bare &x) const
+    {
+        return bare(x.v+1);
+    }
+};
+
+// Fails at the fifth element.
+struct brittle
+{
+    long operator()(long x) const
+    {
+        if(x == 4)
+            throw std::runtime_error("brittle");
+        return x;
+    }
+};
+
+double consume(const stream<long> &s, int n)
+{
+    std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
+    long sum = 0;
+    stream<long>::iterator it = s.begin();
+    for(int i=0; i<n; ++i) {
+        sum += slow()(*it);
+        ++it;
+    }
+    std::chrono::steady_clock::time_point t2 = std::chrono::steady_clock::now();
+    assert(sum == long(n)*(n-1)/2);
+    return std::chrono::duration<double, std::milli>(t2-t1).count();
+}
+
+int main()
+{
+    // A definition owned by the async stream, and one it reads by name.
+    stream<long> g = 0l<<=g+(1l<<=g);
+    stream<long> f = stream<long>::async(g+g, 16);
+    compare(f, {0l,2l,2l,4l,6l,10l,16l,26l,42l,68l}, 1);
+
+    // Nothing else reads h while the producer does; k checks its
+    // elements.
+    stream<long> h = 0l<<=h+(1l<<=h);
+    stream<long> a = stream<long>::async(h, 3);
+    std::vector<long> r(40);
+    a.begin().fill(&r[0], r.size());
+    stream<long> k = 0l<<=k+(1l<<=k);
+    stream<long>::iterator kit = k.begin();
+    for(long x : r) {
+        assert(x == *kit);
+        ++kit;
+    }
+
+    // Elements without a default constructor go one at a time.
+    stream<bare> bn = bare(0)<<=stream<bare>::map(inc(), bn);
+    stream<bare> an = stream<bare>::async(bn, 4);
+    stream<bare>::iterator nit = an.begin();
+    for(long i=0; i<100; ++i) {
+        assert((*nit).v == i);
+        ++nit;
+    }
+
+    // What the producer throws reaches the reader after the elements
+    // before it.
+    stream<long> lone = 1l<<=lone;
+    stream<long> ln = 0l<<=ln+lone;
+    stream<long> e = stream<long>::async(stream<long>::map(brittle(), ln), 2);
+    stream<long>::iterator eit = e.begin();
+    for(long i=0; i<4; ++i) {
+        assert(*eit == i);
+        ++eit;
+    }
+    bool thrown = false;
+    try {
+        *eit;
+    } catch(const std::runtime_error &) {
+        thrown = true;
+    }
+    assert(thrown);
+
+    // Readers that fall behind find what the producer did meanwhile.
+    stream<int> one = 1<<=one;
+    stream<int> nat = 0<<=nat+one;
+    stream<int> b = stream<int>::async(nat, 8, async_wait::spin);
+    stream<int>::iterator bit = b.begin();
+    for(int i=0; i<10000; ++i) {
+        assert(*bit == i);
+        ++bit;
+    }
+    compare(b, {0, 1, 2, 3}, 1);
+
+    // A stream destroyed with a full ring stops its producer.
+    {
+        stream<long> seven = 7l<<=seven;
+        stream<long> c = stream<long>::async(seven, 4);
+        compare(c, {7l}, 1);
+    }
+
+    // A slow definition read by a slow consumer.
+    const int n = 20000;
+    stream<long> l1 = 1l<<=l1;
+    stream<long> l = 0l<<=l+l1;
+    stream<long> s1 = stream<long>::map(slow(), l);
+    stream<long> l2 = 1l<<=l2;
+    stream<long> m = 0l<<=m+l2;
+    stream<long> s2 = stream<long>::async(stream<long>::map(slow(), m));
+    std::cout<<"serial: "<<consume(s1, n)<<" ms, async: "<<consume(s2, n)<<" ms"<<std::endl;
+    return 0;
+}
@@ -26,7 +26,15 @@
  * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+// Built with -DSTREAM2, the streams run on the lockstep engine of
+// stream2.h, which has no delay or expression templates.
+#ifdef STREAM2
+#include "stream2.h"
+#include <iostream>
+using stream2::stream;
+#else
 #include "stream.h"
+#endif
 #include <unordered_map>
 #include <map>
 #include <cstdlib>
@@ -35,9 +43,7 @@
 
 long timeval_diff(struct timeval &tv1, struct timeval &tv2)
 {
-    long ret = tv1.tv_usec - tv2.tv_usec;
-    if(ret<0) ret += 1000000;
-    return ret;
+    return (tv1.tv_sec - tv2.tv_sec)*1000000l + (tv1.tv_usec - tv2.tv_usec);
 }
 
 
@@ -124,7 +130,7 @@ long changedyn(int n, int max=4) {
 template<typename ST>
 stream<long> times(long n, long val, ST && s)
 {
-    if(n==0) return s;
+    if(n==1) return val<<=std::forward<ST>(s);
     return times(n-1, val, val<<=std::forward<ST>(s));
 }
 
@@ -135,6 +141,22 @@ stream<long> change10 = times(10, 0, change10) + change5;
 stream<long> change20 = times(20, 0, change20) + change10;
 stream<long> change50 = times(50, 0, change50) + change20;
 
+#ifndef STREAM2
+stream<long> dchange1 = 1l<<=dchange1;
+stream<long> dchange2 = delay(2, 0, dchange2) + dchange1;
+stream<long> dchange5 = delay(5, 0, dchange5) + dchange2;
+stream<long> dchange10 = delay(10, 0, dchange10) + dchange5;
+stream<long> dchange20 = delay(20, 0, dchange20) + dchange10;
+stream<long> dchange50 = delay(50, 0, dchange50) + dchange20;
+
+stream<long> echange1 = 1l<<=echange1;
+stream<long> echange2 = expr(delay(2, 0, echange2)) + echange1;
+stream<long> echange5 = expr(delay(5, 0, echange5)) + echange2;
+stream<long> echange10 = expr(delay(10, 0, echange10)) + echange5;
+stream<long> echange20 = expr(delay(20, 0, echange20)) + echange10;
+stream<long> echange50 = expr(delay(50, 0, echange50)) + echange20;
+#endif
+
 int main(int argc, char *argv[]) {
     if (argc != 3)
     {
@@ -143,8 +165,12 @@ int main(int argc, char *argv[]) {
                  <<"     X : Algorithm"<<std::endl
                  <<"         1 : map"<<std::endl
                  <<"         2 : unordered map"<<std::endl
-                 <<"         3 : stream"<<std::endl
-                 <<std::endl;
+                 <<"         3 : stream"<<std::endl;
+#ifndef STREAM2
+        std::cout<<"         4 : stream with delay"<<std::endl
+                 <<"         5 : expression template with delay"<<std::endl;
+#endif
+        std::cout<<std::endl;
         return 1;
     }
 
@@ -170,13 +196,34 @@ int main(int argc, char *argv[]) {
             std::cerr<<"Unknown algorighm"<<std::endl;
             return 1;
 
-        case 3:
+        case 3: {
             gettimeofday(&tv1, &tz);
             stream<long>::iterator it = change50.begin();
             for(int i=0; i<n; ++i) ++it;
             *it;
             gettimeofday(&tv2, &tz);
             break;
+        }
+
+#ifndef STREAM2
+        case 4: {
+            gettimeofday(&tv1, &tz);
+            stream<long>::iterator it = dchange50.begin();
+            for(int i=0; i<n; ++i) ++it;
+            *it;
+            gettimeofday(&tv2, &tz);
+            break;
+        }
+
+        case 5: {
+            gettimeofday(&tv1, &tz);
+            stream<long>::iterator it = echange50.begin();
+            for(int i=0; i<n; ++i) ++it;
+            *it;
+            gettimeofday(&tv2, &tz);
+            break;
+        }
+#endif
 
     }
     std::cout<<timeval_diff(tv2, tv1)<<std::endl;
@@ -29,6 +29,10 @@
 #ifndef __TEST_COMMON_H__
 #define __TEST_COMMON_H__
 
+#include <iostream>
+#include <cassert>
+#include <ctime>
+
 
 template<typename T>
 void prints(const stream<T> &s, size_t n=10)
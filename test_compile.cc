@@ -0,0 +1,124 @@
+/*
+ * Copyright (c) 2011-2012, Attila Gobi and Zalan Szugyi
+ * All rights reserved.
+ *
+ * This software was developed by Attila Gobi and Zalan Szugyi.
+ * The project was supported by the European Union and co-financed by the
+ * European Social Fund (grant agreement no. TAMOP 4.2.1./B-09/1/KMR-2010-0003)
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "stream.h"
+#include "test_common.h"
+
+// Reads both streams for n elements, stepping one and filling the other.
+template<typename T>
+void same(const stream<T> &s1, const stream<T> &s2, size_t n=1000)
+{
+    std::vector<T> a(n), b(n);
+    typename stream<T>::iterator it1 = s1.begin(), it2 = s2.begin();
+    for(size_t i=0; i<n; ++i, ++it1)
+        a[i] = *it1;
+    it2.fill(&b[0], n);
+    assert(a == b);
+}
+
+long square(long x)
+{
+    return x*x;
+}
+
+extern stream<double> s2;
+stream<double> s1(1.0<<=s2), s2(.0<<=s1);
+
+int main()
+{
+    stream<long> f = 0l<<=f+(1l<<=f);
+    f.compile();
+    compare(f, {0l,1l,1l,2l,3l,5l,8l,13l,21l,34l}, 1);
+
+    // Mutually recursive streams: only the compiled one changes.
+    s1.compile();
+    compare(s1, {1.,0.});
+    compare(s2, {0.,1.});
+
+    stream<int> pm = 1<<=(-pm);
+    pm.compile();
+    compare(pm, {1,-1});
+
+    // Change in the coins 1, 2, 5 and 10, through delay.
+    stream<long> c1 = 1l<<=c1;
+    stream<long> c2 = delay(2, 0, c2) + c1;
+    stream<long> c5 = delay(5, 0, c5) + c2;
+    stream<long> c10 = delay(10, 0, c10) + c5;
+    c10.compile();
+    compare(c10, {1l,1l,2l,2l,3l,4l,5l,6l,7l,8l,11l,12l}, 1);
+
+    // Functions, lambdas and literals.
+    stream<long> ones = 1l<<=ones;
+    stream<long> nat = 0l<<=nat+ones;
+    stream<long> p1 = stream<long>::map(square, nat) - (nat % (2l<<=ones)) * delay(3, 7, nat);
+    stream<long> p2 = stream<long>::map(square, nat) - (nat % (2l<<=ones)) * delay(3, 7, nat);
+    p2.compile();
+    same(p1, p2);
+
+    stream<long> cyc = 4l<<=5l<<=6l<<=cyc;
+    stream<long> z1 = stream<long>::zipwith([](long a, long b) { return a*3-b; }, nat, cyc);
+    stream<long> z2 = stream<long>::zipwith([](long a, long b) { return a*3-b; }, nat, cyc);
+    z2.compile();
+    same(z1, z2);
+
+    // A stream evaluated in part keeps what it has.
+    stream<long> g = 0l<<=g+(1l<<=g);
+    compare(g, {0l,1l,1l,2l,3l}, 1);
+    g.compile();
+    compare(g, {0l,1l,1l,2l,3l,5l,8l,13l,21l,34l}, 1);
+
+    // An expression template is read as an input.
+    stream<long> e1 = 0l<<=e1 + expr(nat) * expr(nat);
+    stream<long> e2 = 0l<<=e2 + expr(nat) * expr(nat);
+    e2.compile();
+    same(e1, e2);
+
+    // Copies run on from where the original is.
+    stream<long> k = 1l<<=k+k;
+    k.compile();
+    stream<long>::iterator kit = k.begin();
+    for(int i=0; i<5; ++i)
+        ++kit;
+    stream<long> kc = k;
+    compare(kc, {1l,2l,4l,8l,16l,32l}, 1);
+
+    stream<unsigned long> h = 0ul<<=h+(1ul<<=h);
+    h.compile();
+    h.forget();
+    stream<unsigned long>::iterator it = h.begin();
+    std::vector<unsigned long> out(1000);
+    for(int i=0; i<1000; ++i)
+        it.fill(&out[0], out.size());
+    unsigned long a = 0, b = 1;
+    for(int i=0; i<1000000; ++i) {
+        b += a;
+        a = b-a;
+    }
+    assert(*it == a);
+
+    return 0;
+}
@@ -0,0 +1,99 @@
+/*
+ * Copyright (c) 2011-2012, Attila Gobi and Zalan Szugyi
+ * All rights reserved.
+ *
+ * This software was developed by Attila Gobi and Zalan Szugyi.
+ * The project was supported by the European Union and co-financed by the
+ * European Social Fund (grant agreement no. TAMOP 4.2.1./B-09/1/KMR-2010-0003)
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "stream.h"
+#include "test_common.h"
+
+int calls = 0;
+
+long count(long x)
+{
+    ++calls;
+    return x;
+}
+
+template<typename T, typename ST>
+stream<T> prefix(long n, const T &val, ST &&s)
+{
+    if(n==0)
+        return s;
+    return prefix(n-1, val, val<<=std::forward<ST>(s));
+}
+
+stream<long> ones = 1l<<=ones;
+
+stream<long> local()
+{
+    stream<long> s = 3l<<=(2l<<=ones);
+    stream<long> c = s;
+    return c;
+}
+
+int main()
+{
+    // Copies of nodes owned by value, both read after the copy.
+    stream<int> a = 1<<=(2<<=a);
+    stream<int> b = a;
+    compare(b, {1,2});
+    compare(a, {1,2});
+
+    // A copy does not evaluate again what the original has.
+    stream<long> nat = 0l<<=nat+ones;
+    stream<long> m = stream<long>::map(count, nat);
+    compare(m, {0l,1l,2l,3l,4l}, 1);
+    assert(calls == 5);
+    stream<long> c1 = m, c2 = c1;
+    compare(c2, {0l,1l,2l,3l,4l}, 1);
+    compare(c1, {0l,1l,2l,3l,4l,5l}, 1);
+    compare(m, {0l,1l,2l,3l,4l,5l}, 1);
+    assert(calls == 6);
+
+    // An iterator on the original goes on where it was.
+    stream<long>::iterator it = nat.begin();
+    ++it;
+    stream<long> c3 = nat;
+    assert(*it == 1);
+    compare(c3, {0l,1l,2l}, 1);
+
+    // Copies outlive the stream they were made of.
+    compare(local(), {3l,2l,1l,1l}, 1);
+
+    // Many copies are cheap.
+    std::vector<stream<long> > v(100000, nat);
+    compare(v.back(), {0l,1l,2l}, 1);
+
+    // Change in the coins 1, 2, 5 and 10, the prefixes made by copying.
+    stream<unsigned long> d1 = 1ul<<=d1;
+    stream<unsigned long> d2 = prefix(2, 0ul, d2) + d1;
+    stream<unsigned long> d5 = prefix(5, 0ul, d5) + d2;
+    stream<unsigned long> d10 = prefix(10, 0ul, d10) + d5;
+    stream<unsigned long> e10 = delay(10, 0, e10) + (delay(5, 0, d5) + d2);
+    assert(d10.at(1000000000000ul) == e10.at(1000000000000ul));
+    compare(d10, {1ul,1ul,2ul,2ul,3ul,4ul,5ul,6ul,7ul,8ul,11ul,12ul}, 1);
+
+    return 0;
+}
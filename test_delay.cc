@@ -0,0 +1,76 @@
+/*
+ * Copyright (c) 2011-2012, Attila Gobi and Zalan Szugyi
+ * All rights reserved.
+ *
+ * This software was developed by Attila Gobi and Zalan Szugyi.
+ * The project was supported by the European Union and co-financed by the
+ * European Social Fund (grant agreement no. TAMOP 4.2.1./B-09/1/KMR-2010-0003)
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "stream.h"
+#include "test_common.h"
+
+template<typename ST>
+stream<long> times(long n, long val, ST && s)
+{
+    if(n==0) return s;
+    return times(n-1, val, val<<=std::forward<ST>(s));
+}
+
+template<typename T>
+void equal(const stream<T> &s1, const stream<T> &s2, int n=1000)
+{
+    typename stream<T>::iterator it1 = s1.begin(), it2 = s2.begin();
+    for(int i=0; i<n; ++i, ++it1, ++it2)
+        assert(*it1 == *it2);
+}
+
+int main()
+{
+    stream<int> ones = 1<<=ones;
+    stream<int> d1 = delay(3, 7, ones);
+    stream<int> d2 = delay<2>(7, ones + ones);
+    compare(d1, {7,7,7,1,1,1}, 1);
+    compare(d2, {7,7,2,2,2,2}, 1);
+    compare(delay(0, 7, ones + ones), {2,2,2}, 1);
+    compare(delay(0, 7, ones), {1,1,1}, 1);
+
+    stream<int> nat = delay(1, 0, nat + ones);
+    compare(nat, {0,1,2,3,4,5}, 1);
+
+    stream<long> r1 = 1l<<=r1;
+    stream<long> c1 = times(5, 0, c1) + r1;
+    stream<long> c2 = delay(5, 0, c2) + r1;
+    stream<long> c3 = delay<5>(0, c3) + r1;
+    equal(c1, c2);
+    equal(c1, c3);
+
+    stream<long> f1 = 0l<<=f1+(1l<<=f1);
+    stream<long> f2 = delay(1, 0, f2+delay<1>(1, f2));
+    equal(f1, f2, 90);
+
+    stream<long> m = delay(4, 1, -m);
+    m.forget();
+    compare(m, {1l,1l,1l,1l,-1l,-1l,-1l,-1l}, 3);
+
+    return 0;
+}
@@ -0,0 +1,97 @@
+/*
+ * Copyright (c) 2011-2012, Attila Gobi and Zalan Szugyi
+ * All rights reserved.
+ *
+ * This software was developed by Attila Gobi and Zalan Szugyi.
+ * The project was supported by the European Union and co-financed by the
+ * European Social Fund (grant agreement no. TAMOP 4.2.1./B-09/1/KMR-2010-0003)
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "stream.h"
+#include "test_common.h"
+
+// Reads both streams for n elements, stepping one and filling the other.
+template<typename T>
+void same(const stream<T> &s1, const stream<T> &s2, size_t n=1000)
+{
+    std::vector<T> a(n), b(n);
+    typename stream<T>::iterator it1 = s1.begin(), it2 = s2.begin();
+    for(size_t i=0; i<n; ++i, ++it1)
+        a[i] = *it1;
+    it2.fill(&b[0], n);
+    assert(a == b);
+}
+
+long square(long x)
+{
+    return x*x;
+}
+
+int main()
+{
+    stream<long> f = 0l<<=expr(f)+(1l<<=expr(f));
+    compare(f, {0l,1l,1l,2l,3l,5l,8l,13l,21l,34l}, 1);
+
+    stream<long> ones = 1l<<=ones;
+    stream<long> nat1 = 0l<<=nat1+ones, nat2 = 0l<<=expr(nat2)+ones;
+    same(nat1, nat2);
+
+    // Streams, temporaries and expressions mixed on either side.
+    stream<long> p1 = stream<long>::map(square, nat1) - (nat1 % (2l<<=ones)) * delay(3, 7, nat1);
+    stream<long> p2 = stream<long>::map(square, expr(nat1)) - (expr(nat1) % (2l<<=ones)) * delay(3, 7, nat1);
+    same(p1, p2);
+
+    stream<long> q1 = -(ones + nat1) / (3l<<=ones);
+    stream<long> q2 = -(ones + expr(nat1)) / (3l<<=ones);
+    same(q1, q2);
+
+    stream<long> z1 = stream<long>::zipwith(std::minus<long>(), nat1, f);
+    stream<long> z2 = stream<long>::zipwith(std::minus<long>(), expr(nat1), f);
+    same(z1, z2, 50);
+
+    // An expression kept around is copied into each stream made of it.
+    auto e = expr(nat1) * expr(nat1);
+    stream<long> e1 = e, e2 = e + (1l<<=e);
+    compare(e1, {0l,1l,4l,9l,16l}, 1);
+    compare(e2, {1l,1l,5l,13l,25l}, 1);
+
+    // Change in the coins 1, 2, 5 and 10.
+    stream<long> c1 = 1l<<=c1;
+    stream<long> c2 = expr(delay(2, 0, c2)) + c1;
+    stream<long> c5 = expr(delay(5, 0, c5)) + c2;
+    stream<long> c10 = expr(delay(10, 0, c10)) + c5;
+    compare(c10, {1l,1l,2l,2l,3l,4l,5l,6l,7l,8l,11l,12l}, 1);
+
+    stream<unsigned long> h = 0ul<<=expr(h)+(1ul<<=expr(h));
+    h.forget();
+    stream<unsigned long>::iterator it = h.begin();
+    for(int i=0; i<1000000; ++i)
+        ++it;
+    unsigned long a = 0, b = 1;
+    for(int i=0; i<1000000; ++i) {
+        b += a;
+        a = b-a;
+    }
+    assert(*it == a);
+
+    return 0;
+}
@@ -26,15 +26,19 @@
  * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+// Built with -DSTREAM2, the test runs on the lockstep engine of stream2.h.
+#ifdef STREAM2
+#include "stream2.h"
+using stream2::stream;
+#else
 #include "stream.h"
+#endif
 #include "test_common.h"
 #include <sys/time.h>
 
 long timeval_diff(struct timeval &tv1, struct timeval &tv2)
 {
-    long ret = tv1.tv_usec - tv2.tv_usec;
-    if(ret<0) ret += 1000000;
-    return ret;
+    return (tv1.tv_sec - tv2.tv_sec)*1000000l + (tv1.tv_usec - tv2.tv_usec);
 }
 
 
@@ -66,6 +70,29 @@ int main()
   gettimeofday(&tv2, &tz);
   std::cout<<timeval_diff(tv2, tv1)<<std::endl;
 
+#ifndef STREAM2
+  // The same definition as an expression template.
+  stream<long> x = 0l<<=expr(x)+(1l<<=expr(x));
+  compare(x,  {0l,1l,1l,2l,3l,5l,8l,13l,21l,34l}, 1);
+  gettimeofday(&tv1, &tz);
+  stream<long>::iterator xit = x.begin();
+  for(int i=0; i<n; ++i) ++xit;
+  *xit;
+  gettimeofday(&tv2, &tz);
+  std::cout<<timeval_diff(tv2, tv1)<<std::endl;
+
+  // And compiled into a program.
+  stream<long> y = 0l<<=y+(1l<<=y);
+  y.compile();
+  compare(y,  {0l,1l,1l,2l,3l,5l,8l,13l,21l,34l}, 1);
+  gettimeofday(&tv1, &tz);
+  stream<long>::iterator yit = y.begin();
+  for(int i=0; i<n; ++i) ++yit;
+  *yit;
+  gettimeofday(&tv2, &tz);
+  std::cout<<timeval_diff(tv2, tv1)<<std::endl;
+#endif
+
   gettimeofday(&tv1, &tz);
   fib(n);
   gettimeofday(&tv2, &tz);
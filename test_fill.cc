@@ -0,0 +1,98 @@
+/*
+ * Copyright (c) 2011-2012, Attila Gobi and Zalan Szugyi
+ * All rights reserved.
+ *
+ * This software was developed by Attila Gobi and Zalan Szugyi.
+ * The project was supported by the European Union and co-financed by the
+ * European Social Fund (grant agreement no. TAMOP 4.2.1./B-09/1/KMR-2010-0003)
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "stream.h"
+#include "test_common.h"
+
+template<typename ST>
+stream<long> times(long n, long val, ST && s)
+{
+    if(n==0) return s;
+    return times(n-1, val, val<<=std::forward<ST>(s));
+}
+
+// Reads s once element by element and once in blocks of n.
+template<typename T>
+void check(const stream<T> &s1, const stream<T> &s2, size_t n, size_t total=5000)
+{
+    std::vector<T> a(total), b(total);
+    typename stream<T>::iterator it1 = s1.begin(), it2 = s2.begin();
+    for(size_t i=0; i<total; ++i, ++it1)
+        a[i] = *it1;
+    for(size_t i=0; i<total; i+=n)
+        it2.fill(&b[i], std::min(n, total-i));
+    assert(a == b);
+    assert(*it1 == *it2);
+}
+
+// A map that remembers: the running sum of what it has seen.
+struct running
+{
+    running(): sum_(0) { }
+    long operator()(long x) { return sum_ += x; }
+    long sum_;
+};
+
+int main()
+{
+    stream<long> ones = 1l<<=ones;
+    stream<long> nat1 = 0l<<=nat1+ones, nat2 = 0l<<=nat2+ones;
+    check(nat1, nat2, 1000);
+
+    stream<long> f1 = 0l<<=f1+(1l<<=f1), f2 = 0l<<=f2+(1l<<=f2);
+    check(f1, f2, 7);
+
+    stream<long> g1 = (1l<<=2l<<=g1)-(5l<<=g1), g2 = (1l<<=2l<<=g2)-(5l<<=g2);
+    check(g1, g2, 64);
+
+    stream<long> c1 = times(5, 0, c1) + ones, c2 = delay(5, 0, c2) + ones;
+    check(c1, c2, 3);
+
+    stream<long> p1 = -(nat1*nat1) + delay<3>(7, nat1%(2l<<=ones));
+    stream<long> p2 = -(nat2*nat2) + delay<3>(7, nat2%(2l<<=ones));
+    check(p1, p2, 4096, 100000);
+
+    // A stateful op sees the same elements in the same order either way.
+    stream<long> r1 = map(running(), nat1), r2 = map(running(), nat2);
+    check(r1, r2, 10);
+    stream<long> r3 = map(running(), nat1+ones);
+    long r[10];
+    r3.begin().fill(r, 10);
+    assert(r[9] == 55);
+    stream<long> r4 = map(running(), nat1+ones);
+    stream<long>::iterator rt = r4.begin();
+    rt.advance(9);
+    assert(*rt == 55);
+
+    stream<long> zo = 0l<<=1l<<=zo;
+    long z[5];
+    zo.begin().fill(z, 5);
+    assert(z[0]==0 && z[1]==1 && z[2]==0 && z[3]==1 && z[4]==0);
+
+    return 0;
+}
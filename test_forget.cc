@@ -0,0 +1,78 @@
+/*
+ * Copyright (c) 2011-2012, Attila Gobi and Zalan Szugyi
+ * All rights reserved.
+ *
+ * This software was developed by Attila Gobi and Zalan Szugyi.
+ * The project was supported by the European Union and co-financed by the
+ * European Social Fund (grant agreement no. TAMOP 4.2.1./B-09/1/KMR-2010-0003)
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "stream.h"
+#include "test_common.h"
+#include <sys/resource.h>
+
+template<typename ST>
+stream<long> times(long n, long val, ST && s)
+{
+    if(n==0) return s;
+    return times(n-1, val, val<<=std::forward<ST>(s));
+}
+
+long maxrss()
+{
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_maxrss;
+}
+
+int main()
+{
+    stream<int> zo = 0<<=1<<=2<<=zo;
+    zo.forget();
+    compare(zo, {0,1,2});
+
+    stream<long> d = times(3, 0, d) + (1l<<=d);
+    stream<long> e = times(3, 0, e) + (1l<<=e);
+    e.forget();
+    {
+        stream<long>::iterator dit = d.begin(), eit = e.begin();
+        for(int i=0; i<1000; ++i, ++dit, ++eit)
+            assert(*dit == *eit);
+    }
+
+    stream<unsigned long> s = 0ul<<=s+(1ul<<=s);
+    s.forget();
+
+    const long n = 100000000;
+    unsigned long a=0, b=1;
+    stream<unsigned long>::iterator it = s.begin();
+    for(long i=0; i<n; ++i) {
+        assert(*it == a);
+        b+=a;
+        a=b-a;
+        ++it;
+    }
+    std::cout<<*it<<" "<<maxrss()<<"kB"<<std::endl;
+    assert(maxrss() < 64*1024);
+
+    return 0;
+}
@@ -0,0 +1,123 @@
+/*
+ * Copyright (c) 2011-2012, Attila Gobi and Zalan Szugyi
+ * All rights reserved.
+ *
+ * This software was developed by Attila Gobi and Zalan Szugyi.
+ * The project was supported by the European Union and co-financed by the
+ * European Social Fund (grant agreement no. TAMOP 4.2.1./B-09/1/KMR-2010-0003)
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define STREAM_STATS
+#include "stream.h"
+#include "test_common.h"
+#include <chrono>
+
+template<typename T>
+std::vector<T> take(const stream<T> &s, std::size_t n)
+{
+    std::vector<T> x(n);
+    s.begin().fill(&x[0], n);
+    return x;
+}
+
+// One element at a time, through get and next.
+template<typename T>
+std::vector<T> walk(const stream<T> &s, std::size_t n)
+{
+    std::vector<T> x(n);
+    typename stream<T>::iterator it = s.begin();
+    for(std::size_t i=0; i<n; ++i, ++it)
+        x[i] = *it;
+    return x;
+}
+
+template<typename F>
+double time(F f)
+{
+    std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
+    f();
+    std::chrono::steady_clock::time_point t2 = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::milli>(t2-t1).count();
+}
+
+int main()
+{
+    stream<long> one = 1l<<=one;
+    stream<long> a = 0l<<=a+one;
+    stream<long> b = 5l<<=b+one;
+    stream<long> c = 2l<<=c;
+    take(a, 10);
+    take(b, 10);
+
+    // One node for the whole expression, element by element.
+    stream<long> x = -(a + b) * c;
+    stream_stats::reset();
+    compare(x, {-10l, -14l, -18l, -22l}, 1);
+    assert(stream_stats::of(stream_stats::fuse).allocs == 1);
+    assert(stream_stats::of(stream_stats::map2).allocs == 0);
+    assert(stream_stats::of(stream_stats::zip2).allocs == 0);
+    assert(stream_stats::of(stream_stats::val).allocs == 4);
+
+    // Named streams stay apart, as others may read them.
+    stream<long> s = a + b;
+    stream<long> y = -s;
+    stream_stats::reset();
+    compare(y, {-5l, -7l, -9l}, 1);
+    assert(stream_stats::of(stream_stats::fuse).allocs == 0);
+
+    // Reading itself behind a prefix, in bulk.
+    stream<long> p = 1000003l<<=p;
+    stream<long> r = 1l<<=(r*r + r*a + one) % p;
+    std::vector<long> v = take(r, 10000);
+    long e = 1;
+    for(long i=0; i<10000; ++i) {
+        assert(v[i] == e);
+        e = (e*e + e*i + 1) % 1000003;
+    }
+
+    // Parallel operations keep their own nodes.
+    stream_stats::reset();
+    stream<long> z = stream<long>::map(stream_par, std::negate<long>(), a + b);
+    compare(z, {-5l, -7l, -9l}, 1);
+    assert(stream_stats::of(stream_stats::map2).allocs == 1);
+
+    // Depth 7, fused against the same levels kept apart by names.
+    const std::size_t n = 1000000;
+    stream<long> one2 = 1l<<=one2;
+    stream<long> u = stream<long>::scan(std::plus<long>(), 0l, one2);
+    u.forget();
+    stream<long> f = ((((((u + one2) * u) - u) + one2) * one2) - u) + u;
+    f.forget();
+    stream<long> one3 = 1l<<=one3;
+    stream<long> w = stream<long>::scan(std::plus<long>(), 0l, one3);
+    w.forget();
+    stream<long> g1 = w + one3, g2 = g1 * w, g3 = g2 - w, g4 = g3 + one3;
+    stream<long> g5 = g4 * one3, g6 = g5 - w, g = g6 + w;
+    for(stream<long> *h : {&g1, &g2, &g3, &g4, &g5, &g6, &g})
+        h->forget();
+    std::vector<long> r1, r2;
+    const double t1 = time([&] { r1 = walk(f, n); });
+    const double t2 = time([&] { r2 = walk(g, n); });
+    assert(r1 == r2);
+    std::cout<<"fused: "<<t1<<" ms, apart: "<<t2<<" ms"<<std::endl;
+    return 0;
+}
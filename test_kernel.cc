@@ -0,0 +1,131 @@
+/*
+ * Copyright (c) 2011-2012, Attila Gobi and Zalan Szugyi
+ * All rights reserved.
+ *
+ * This software was developed by Attila Gobi and Zalan Szugyi.
+ * The project was supported by the European Union and co-financed by the
+ * European Social Fund (grant agreement no. TAMOP 4.2.1./B-09/1/KMR-2010-0003)
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "stream.h"
+#include "test_common.h"
+
+// Runs each kernel over every length up to n against the plain loop.
+template<typename T, typename Op>
+void check_kernel(Op op, size_t n=300)
+{
+    std::vector<T> a(n), b(n), r(n);
+    for(size_t i=0; i<n; ++i) {
+        a[i] = T(i*7%23) - T(11);
+        b[i] = T(i*5%13) + T(1);
+    }
+    for(size_t k=0; k<=n; ++k) {
+        stream_kernel<Op, T>::apply(op, &a[0], &b[0], &r[0], k);
+        for(size_t i=0; i<k; ++i)
+            assert(r[i] == op(a[i], b[i]));
+    }
+}
+
+template<typename T>
+void check_kernels()
+{
+    check_kernel<T>(std::plus<T>());
+    check_kernel<T>(std::minus<T>());
+    check_kernel<T>(std::multiplies<T>());
+    check_kernel<T>(std::divides<T>());
+
+    std::vector<T> a(100), r(100);
+    for(size_t i=0; i<a.size(); ++i)
+        a[i] = T(i) - T(50);
+    stream_kernel<std::negate<T>, T>::apply(std::negate<T>(), &a[0], &r[0], a.size());
+    for(size_t i=0; i<a.size(); ++i)
+        assert(r[i] == -a[i]);
+}
+
+template<typename T>
+stream<T> pipeline(const stream<T> &a, const stream<T> &b)
+{
+    return -(a*b + a - b*b)/(b+b);
+}
+
+// A pipeline over cyclic inputs, once kept and stepped, once forgotten
+// and read in blocks.
+template<typename T>
+void check_pipeline(size_t total=20000, size_t n=1000)
+{
+    stream<T> a = T(3)<<=T(-1)<<=T(4)<<=T(1)<<=T(-5)<<=T(9)<<=T(2)<<=a;
+    stream<T> b = T(2)<<=T(7)<<=T(1)<<=T(8)<<=T(3)<<=b;
+
+    stream<T> p1 = pipeline(a, b), p2 = pipeline(a, b);
+    p2.forget();
+
+    std::vector<T> r1(total), r2(total);
+    typename stream<T>::iterator it1 = p1.begin(), it2 = p2.begin();
+    for(size_t i=0; i<total; ++i, ++it1)
+        r1[i] = *it1;
+    for(size_t i=0; i<total; i+=n)
+        it2.fill(&r2[i], std::min(n, total-i));
+    assert(r1 == r2);
+}
+
+template<typename T>
+void bench(const char *name, size_t total=1<<24, size_t n=4096)
+{
+    stream<T> a = T(3)<<=T(-1)<<=T(4)<<=T(1)<<=T(-5)<<=T(9)<<=T(2)<<=a;
+    stream<T> b = T(2)<<=T(7)<<=T(1)<<=T(8)<<=T(3)<<=b;
+    stream<T> p = a*b + a - b;
+    p.forget();
+
+    std::vector<T> r(n);
+    T sum = 0;
+    typename stream<T>::iterator it = p.begin();
+    clock_t t1 = clock();
+    for(size_t i=0; i<total; i+=n) {
+        it.fill(&r[0], n);
+        sum += r[n-1];
+    }
+    clock_t t2 = clock();
+    std::cout<<name<<": "<<(double(t2)-double(t1))/CLOCKS_PER_SEC*1e9/total
+        <<" ns/element ("<<sum<<")"<<std::endl;
+}
+
+int main()
+{
+    check_kernels<int>();
+    check_kernels<long>();
+    check_kernels<float>();
+    check_kernels<double>();
+    check_kernel<int>(std::modulus<int>());
+    check_kernel<long>(std::modulus<long>());
+
+    check_pipeline<int>();
+    check_pipeline<long>();
+    check_pipeline<float>();
+    check_pipeline<double>();
+
+    bench<int>("int");
+    bench<long>("long");
+    bench<float>("float");
+    bench<double>("double");
+
+    return 0;
+}
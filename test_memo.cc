@@ -0,0 +1,93 @@
+/*
+ * Copyright (c) 2011-2012, Attila Gobi and Zalan Szugyi
+ * All rights reserved.
+ *
+ * This software was developed by Attila Gobi and Zalan Szugyi.
+ * The project was supported by the European Union and co-financed by the
+ * European Social Fund (grant agreement no. TAMOP 4.2.1./B-09/1/KMR-2010-0003)
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "stream.h"
+#include "test_common.h"
+
+long fib(int n)
+{
+    long a=0, b=1;
+    for(int i=0; i<n; ++i) {
+        b+=a;
+        a=b-a;
+    }
+    return a;
+}
+
+void read(const stream<long>::memo &m, int n, int step)
+{
+    stream<long>::memo::iterator it = m.begin();
+    std::vector<long> r(step);
+    for(int i=0; i<n; i+=step) {
+        it.fill(&r[0], step);
+        for(int j=0; j<step; ++j)
+            assert(r[j] == (i+j)%7);
+    }
+}
+
+int main()
+{
+    // Two iterators on one memo go their own ways.
+    stream<long> f = 0l<<=f+(1l<<=f);
+    stream<long>::memo m(f, 4);
+    stream<long>::memo::iterator a = m.begin(), b = m.begin();
+    for(int i=0; i<10; ++i) {
+        assert(*a == fib(i));
+        ++a;
+    }
+    for(int i=0; i<20; ++i) {
+        assert(*b == fib(i));
+        ++b;
+    }
+    assert(*a == fib(10));
+    stream<long>::memo::iterator c = a;
+    ++c;
+    assert(*c == fib(11) && *a == fib(10));
+    compare(f, {0l, 1l, 1l, 2l, 3l}, 1);
+
+    // Readers on several threads, each in blocks of its own size.
+    stream<long> one = 1l<<=one;
+    stream<long> nat = 0l<<=nat+one;
+    stream<long> mod = 0l<<=1l<<=2l<<=3l<<=4l<<=5l<<=6l<<=mod;
+    stream<long>::memo p(mod+(nat-nat), 100);
+    std::vector<std::thread> readers;
+    for(int t=1; t<=4; ++t)
+        readers.push_back(std::thread(read, std::cref(p), 30000, t));
+    for(std::thread &t : readers)
+        t.join();
+
+    // Once forgotten, segments behind every iterator go.
+    stream<long>::memo q(mod+(nat-nat), 16);
+    stream<long>::memo::iterator x = q.begin();
+    q.forget();
+    std::vector<long> r(1000);
+    x.fill(&r[0], r.size());
+    for(std::size_t i=0; i<r.size(); ++i)
+        assert(r[i] == long(i%7));
+    return 0;
+}
@@ -0,0 +1,100 @@
+/*
+ * Copyright (c) 2011-2012, Attila Gobi and Zalan Szugyi
+ * All rights reserved.
+ *
+ * This software was developed by Attila Gobi and Zalan Szugyi.
+ * The project was supported by the European Union and co-financed by the
+ * European Social Fund (grant agreement no. TAMOP 4.2.1./B-09/1/KMR-2010-0003)
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "stream.h"
+#include "test_common.h"
+#include <cstdlib>
+#include <utility>
+
+struct divide
+{
+    double operator()(double x, int n) const { return x/n; }
+};
+
+struct index
+{
+    std::pair<int, double> operator()(int n, double x) const
+    {
+        return std::make_pair(n, x);
+    }
+};
+
+struct half
+{
+    double operator()(long n) const { return n/2.; }
+};
+
+int main()
+{
+    setenv("STREAM_THREADS", "3", 0);
+
+    stream<int> one = 1<<=one;
+    stream<int> nat = 1<<=nat+one;
+    stream<double> x = .5<<=x;
+
+    compare(zipwith<double>(std::multiplies<double>(), nat, x), {.5, 1., 1.5, 2.}, 1);
+    compare(map(half(), nat), {.5, 1., 1.5, 2.}, 1);
+    compare(stream<long>::map(std::negate<long>(), nat), {-1l, -2l, -3l}, 1);
+
+    // Pairs straight from the two streams.
+    stream<std::pair<int, double> > p = zipwith(index(), nat, x);
+    stream<std::pair<int, double> >::iterator it = p.begin();
+    for(int i=1; i<10; ++i, ++it)
+        assert(*it == std::make_pair(i, .5));
+
+    // Recursive: the terms of e, t(n) = t(n-1)/n.
+    stream<double> t = 1.<<=zipwith(divide(), t, nat);
+    compare(t, {1., 1., .5, 1./6, 1./24}, 1);
+    t.compile();
+    compare(t, {1., 1., .5, 1./6, 1./24}, 1);
+
+    // The same read in bulk, and forgotten as it goes.
+    stream<int> one2 = 1<<=one2;
+    stream<int> nat2 = 1<<=nat2+one2;
+    nat2.forget();
+    stream<long> sum = 0l<<=zipwith<long>(std::plus<long>(), sum, nat2);
+    sum.forget();
+    std::vector<long> s(100000);
+    sum.begin().fill(&s[0], s.size());
+    for(std::size_t i=0; i<s.size(); ++i)
+        assert(s[i] == long(i)*long(i+1)/2);
+
+    // On the pool, and pulled on two threads.
+    stream<int> one3 = 1<<=one3;
+    stream<int> nat3 = 1<<=nat3+one3;
+    stream<double> y = .5<<=y;
+    stream<double> z = zipwith(stream_par, std::multiplies<double>(), nat3, y);
+    std::vector<double> r(10000);
+    z.begin().fill(&r[0], r.size());
+    for(std::size_t i=0; i<r.size(); ++i)
+        assert(r[i] == (i+1)/2.);
+    stream<double> h = map(stream_par, half(), nat3);
+    h.begin().fill(&r[0], r.size());
+    assert(r[9] == 5.);
+    return 0;
+}
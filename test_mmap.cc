@@ -0,0 +1,126 @@
+/*
+ * Copyright (c) 2011-2012, Attila Gobi and Zalan Szugyi
+ * All rights reserved.
+ *
+ * This software was developed by Attila Gobi and Zalan Szugyi.
+ * The project was supported by the European Union and co-financed by the
+ * European Social Fund (grant agreement no. TAMOP 4.2.1./B-09/1/KMR-2010-0003)
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "stream.h"
+#include "test_common.h"
+#include <cstdio>
+#include <unistd.h>
+
+#ifdef HAVE_MMAP
+
+struct half
+{
+    double operator()(int x) const { return x/2.; }
+};
+
+// Trivially copyable, but with no default constructor.
+struct mark
+{
+    explicit mark(int v): v_(v) { }
+    int v_;
+};
+
+int main()
+{
+    // 0, 1, ..., 999 as ints, and three bytes more.
+    char path[] = "/tmp/test_mmapXXXXXX";
+    const int fd = mkstemp(path);
+    assert(fd >= 0);
+    std::vector<int> v(1000);
+    for(std::size_t i=0; i<v.size(); ++i)
+        v[i] = i;
+    assert(write(fd, &v[0], v.size()*sizeof(int)) == ssize_t(v.size()*sizeof(int)));
+    assert(write(fd, "abc", 3) == 3);
+    close(fd);
+
+    stream<int> c = stream<int>::from_mmap(path);
+    compare(c, {0, 1, 2, 3}, 1);
+    std::vector<int> r(2500);
+    c.begin().fill(&r[0], r.size());
+    for(std::size_t i=0; i<r.size(); ++i)
+        assert(r[i] == int(i%1000));
+
+    stream<int> p = stream<int>::from_mmap(path, -1);
+    p.begin().fill(&r[0], r.size());
+    assert(r[999] == 999 && r[1000] == -1 && r[2499] == -1);
+
+    // As an operand, drained from the mapping.
+    stream<int> one = 1<<=one;
+    stream<int> s = stream<int>::from_mmap(path) + one;
+    s.begin().fill(&r[0], r.size());
+    for(std::size_t i=0; i<r.size(); ++i)
+        assert(r[i] == int(i%1000)+1);
+    stream<double> h = map(half(), stream<int>::from_mmap(path, 0));
+    compare(h, {0., .5, 1., 1.5}, 1);
+    stream<int> z = stream<int>::zipwith(std::multiplies<int>(), stream<int>::from_mmap(path), c);
+    compare(z, {0, 1, 4, 9}, 1);
+
+    // Skipped without reading.
+    stream<int> k = stream<int>::from_mmap(path);
+    k.forget();
+    stream<int>::iterator it = k.begin();
+    it.advance(1000000000007ul);
+    assert(*it == 7);
+    stream<int> q = stream<int>::from_mmap(path, 5);
+    q.forget();
+    stream<int>::iterator qt = q.begin();
+    qt.advance(998);
+    assert(*qt == 998);
+    qt.advance(10);
+    assert(*qt == 5);
+
+    // Elements that cannot be default constructed, got one by one.
+    stream<mark> m = stream<mark>::from_mmap(path);
+    stream<mark>::iterator mt = m.begin();
+    for(int i=0; i<1005; ++i, ++mt)
+        assert((*mt).v_ == i%1000);
+    stream<mark> mp = stream<mark>::from_mmap(path, mark(-1));
+    stream<mark>::iterator mpt = mp.begin();
+    for(int i=0; i<1005; ++i, ++mpt)
+        assert((*mpt).v_ == (i < 1000 ? i : -1));
+
+    unlink(path);
+
+    bool thrown = false;
+    try {
+        stream<int>::from_mmap(path);
+    } catch(const std::system_error &e) {
+        thrown = e.code().value() == ENOENT;
+    }
+    assert(thrown);
+    return 0;
+}
+
+#else
+
+int main()
+{
+    return 0;
+}
+
+#endif
@@ -0,0 +1,195 @@
+/*
+ * Copyright (c) 2011-2012, Attila Gobi and Zalan Szugyi
+ * All rights reserved.
+ *
+ * This software was developed by Attila Gobi and Zalan Szugyi.
+ * The project was supported by the European Union and co-financed by the
+ * European Social Fund (grant agreement no. TAMOP 4.2.1./B-09/1/KMR-2010-0003)
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "stream.h"
+#include "test_common.h"
+#include <memory>
+#include <string>
+
+// A string that counts how often it is copied.
+struct counted
+{
+    counted()
+    {
+        ++made;
+    }
+
+    counted(const std::string &s)
+        :s(s)
+    { }
+
+    counted(const counted &o)
+        :s(o.s)
+    {
+        ++copies;
+    }
+
+    counted(counted &&o)
+        :s(std::move(o.s))
+    { }
+
+    counted &operator=(const counted &o)
+    {
+        s = o.s;
+        ++copies;
+        return *this;
+    }
+
+    counted &operator=(counted &&o)
+    {
+        s = std::move(o.s);
+        return *this;
+    }
+
+    std::string s;
+    static long copies;
+    static long made;
+};
+
+long counted::copies = 0;
+long counted::made = 0;
+
+// A number with no default constructor, which nodes cannot buffer.
+struct bare
+{
+    explicit bare(long v)
+        :v(v)
+    { }
+
+    long v;
+};
+
+struct inc
+{
+    bare operator()(const bare &x) const
+    {
+        return bare(x.v+1);
+    }
+};
+
+struct sum
+{
+    bare operator()(const bare &x, const bare &y) const
+    {
+        return bare(x.v+y.v);
+    }
+};
+
+struct grow
+{
+    counted operator()(const counted &x) const
+    {
+        return counted(x.s + "a");
+    }
+};
+
+struct join
+{
+    counted operator()(const counted &x, const counted &y) const
+    {
+        return counted(x.s + y.s);
+    }
+};
+
+// Elements that can only be moved.
+typedef std::unique_ptr<long> box;
+
+struct next_box
+{
+    box operator()(const box &x) const
+    {
+        return box(new long(*x+1));
+    }
+};
+
+struct add_box
+{
+    box operator()(const box &x, const box &y) const
+    {
+        return box(new long(*x+*y));
+    }
+};
+
+int main()
+{
+    stream<counted> h = counted("")<<=stream<counted>::map(grow(), h);
+    stream<counted> m = stream<counted>::map(grow(), h);
+    stream<counted> z = stream<counted>::zipwith(join(), h, m);
+
+    // Results go into their nodes as they are, element by element, and
+    // no buffer is set up for them.
+    counted::copies = 0;
+    counted::made = 0;
+    stream<counted>::iterator it = z.begin();
+    for(std::size_t i=0; i<100; ++i, ++it)
+        assert((*it).s == std::string(i, 'a') + std::string(i+1, 'a'));
+    assert(counted::copies == 0);
+    assert(counted::made == 0);
+
+    // In bulk, the fused operations hand their results over, and only
+    // what is both kept and given out is copied.
+    stream<counted> f = stream<counted>::map(grow(), stream<counted>::map(grow(), h));
+    std::vector<counted> out(1000);
+    f.begin().fill(&out[0], 1000);
+    for(std::size_t i=0; i<out.size(); ++i)
+        assert(out[i].s == std::string(i+2, 'a'));
+    counted::copies = 0;
+    stream<counted> g = stream<counted>::map(grow(), stream<counted>::map(grow(), h));
+    g.begin().fill(&out[0], 1000);
+    assert(counted::copies == 2000);
+
+    // Without a default constructor, the nodes go one element at a time.
+    stream<bare> n = bare(0)<<=stream<bare>::map(inc(), n);
+    stream<bare> d = stream<bare>::zipwith(sum(), n, stream<bare>::map(inc(), n));
+    std::vector<bare> ds(1000, bare(-1));
+    d.begin().fill(&ds[0], ds.size());
+    for(std::size_t i=0; i<ds.size(); ++i)
+        assert(ds[i].v == long(2*i+1));
+
+    // Move-only elements are made in their nodes and read there, stepped,
+    // skipped and forgotten; nothing copies them.
+    stream<box> bn = box(new long(0))<<=stream<box>::map(next_box(), bn);
+    stream<box> bf = box(new long(0))<<=stream<box>::zipwith(add_box(), bf, box(new long(1))<<=bf);
+    stream<box>::iterator bi = bn.begin(), fi = bf.begin();
+    long fa = 0, fb = 1;
+    for(long i=0; i<50; ++i, ++bi, ++fi) {
+        assert(**bi == i && **fi == fa);
+        fb += fa;
+        fa = fb - fa;
+    }
+    bi.advance(1000);
+    assert(**bi == 1050);
+    stream<box> bl = stream<box>::map(next_box(), bn);
+    bl.forget();
+    stream<box>::iterator li = bl.begin();
+    li.advance(100000);
+    for(long i=0; i<100000; ++i)
+        ++li;
+    assert(**li == 200001);
+    return 0;
+}
@@ -26,7 +26,13 @@
  * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+// Built with -DSTREAM2, the test runs on the lockstep engine of stream2.h.
+#ifdef STREAM2
+#include "stream2.h"
+using stream2::stream;
+#else
 #include "stream.h"
+#endif
 #include "test_common.h"
 
 extern stream<double> s2;
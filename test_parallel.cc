@@ -0,0 +1,147 @@
+/*
+ * Copyright (c) 2011-2012, Attila Gobi and Zalan Szugyi
+ * All rights reserved.
+ *
+ * This software was developed by Attila Gobi and Zalan Szugyi.
+ * The project was supported by the European Union and co-financed by the
+ * European Social Fund (grant agreement no. TAMOP 4.2.1./B-09/1/KMR-2010-0003)
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "stream.h"
+#include "test_common.h"
+#include <chrono>
+#include <cstdlib>
+
+// About a microsecond of work per element.
+struct slow
+{
+    long operator()(long x) const
+    {
+        volatile long y = x;
+        for(int i=0; i<500; ++i)
+            y = y + 1;
+        return y - 500;
+    }
+
+    long operator()(long x, long y) const
+    {
+        return (*this)(x) + (*this)(y);
+    }
+};
+
+// Fails from the element from_ on, in every piece past it.
+struct picky
+{
+    explicit picky(long from): from_(from) { }
+
+    long operator()(long x) const
+    {
+        if(x >= from_)
+            throw std::runtime_error("picky");
+        return x;
+    }
+
+    long operator()(long x, long y) const
+    {
+        return (*this)(x) + (*this)(y);
+    }
+
+    long from_;
+};
+
+// Whether reading n elements of s throws picky's error.
+bool fails(const stream<long> &s, std::size_t n)
+{
+    std::vector<long> r(n);
+    try {
+        s.begin().fill(&r[0], n);
+    } catch(const std::runtime_error &) {
+        return true;
+    }
+    return false;
+}
+
+template<typename S>
+double time(const S &s, std::vector<long> &r)
+{
+    std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
+    s.begin().fill(&r[0], r.size());
+    std::chrono::steady_clock::time_point t2 = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::milli>(t2-t1).count();
+}
+
+int main()
+{
+    // Workers even on one core, so that the stealing runs.
+    setenv("STREAM_THREADS", "3", 0);
+
+    stream<long> one = 1l<<=one;
+    stream<long> nat = 0l<<=nat+one;
+    stream<long> two = 2l<<=two;
+    stream<long> odd = 1l<<=odd+two;
+
+    // Operands apart: pulled on two threads.
+    stream<long> a = stream<long>::zipwith(stream_par, slow(),
+        stream<long>::map(stream_par, slow(), nat), stream<long>::map(slow(), odd));
+    compare(a, {1l, 4l, 7l, 10l, 13l}, 1);
+
+    // Operands reading the same stream, and a recursion: one thread each.
+    stream<long> b = stream<long>::zipwith(stream_par, slow(), nat, nat+one);
+    compare(b, {1l, 3l, 5l, 7l}, 1);
+    stream<long> f = 0l<<=stream<long>::zipwith(stream_par, std::plus<long>(), f, 1l<<=f);
+    compare(f, {0l,1l,1l,2l,3l,5l,8l,13l,21l,34l}, 1);
+    stream<long> g = 0l<<=stream<long>::map(stream_par, slow(), g+one);
+    compare(g, {0l,1l,2l,3l}, 1);
+
+    // An op throwing on the pool, here or on a worker, in one piece or
+    // many, reaches the reader.
+    for(long from : {0l, 100l, 2000l, 4095l}) {
+        assert(fails(stream<long>::map(stream_par, picky(from), nat), 4096));
+        assert(fails(stream<long>::zipwith(stream_par, picky(from), nat, odd), 4096));
+        assert(fails(stream<long>::zipwith(stream_par, std::plus<long>(),
+            stream<long>::map(picky(from), nat), stream<long>::map(slow(), odd)), 4096));
+        assert(fails(stream<long>::zipwith(stream_par, std::plus<long>(),
+            stream<long>::map(slow(), nat), stream<long>::map(picky(from), odd)), 4096));
+    }
+
+    // Read one at a time, in blocks, and against the sequential result.
+    stream<long> one2 = 1l<<=one2;
+    stream<long> nat2 = 0l<<=nat2+one2;
+    stream<long> two2 = 2l<<=two2;
+    stream<long> odd2 = 1l<<=odd2+two2;
+    stream<long> s = stream<long>::zipwith(slow(),
+        stream<long>::map(slow(), nat2), stream<long>::map(slow(), odd2));
+    stream<long> p = stream<long>::zipwith(stream_par, slow(),
+        stream<long>::map(stream_par, slow(), nat), stream<long>::map(stream_par, slow(), odd));
+    std::vector<long> r1(20000), r2(20000);
+    const double t1 = time(s, r1);
+    const double t2 = time(p, r2);
+    assert(r1 == r2);
+    stream<long>::iterator it = p.begin();
+    for(long x : r1) {
+        assert(*it == x);
+        ++it;
+    }
+    std::cout<<"sequential: "<<t1<<" ms, parallel: "<<t2<<" ms on "
+        <<stream_pool::instance().workers()<<" workers"<<std::endl;
+    return 0;
+}
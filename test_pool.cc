@@ -0,0 +1,106 @@
+/*
+ * Copyright (c) 2011-2012, Attila Gobi and Zalan Szugyi
+ * All rights reserved.
+ *
+ * This software was developed by Attila Gobi and Zalan Szugyi.
+ * The project was supported by the European Union and co-financed by the
+ * European Social Fund (grant agreement no. TAMOP 4.2.1./B-09/1/KMR-2010-0003)
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "stream.h"
+#include "test_common.h"
+#include <chrono>
+
+// The same recurrence on the plain heap, to compare against the pool.
+template<>
+struct stream_allocator<unsigned long>
+{
+    typedef heap_allocator type;
+};
+
+template<typename T>
+double walk(int n)
+{
+    stream<T> s = T(0)<<=s+(T(1)<<=s);
+    std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
+    typename stream<T>::iterator it = s.begin();
+    for(int i=0; i<n; ++i)
+        ++it;
+    *it;
+    std::chrono::steady_clock::time_point t2 = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::milli>(t2-t1).count();
+}
+
+struct fib
+{
+    fib()
+        :s(0l<<=s+(1l<<=s))
+    { }
+
+    stream<long> s;
+};
+
+// A stream with n elements read on this thread.
+fib *make(int n)
+{
+    fib *f = new fib;
+    stream<long>::iterator it = f->s.begin();
+    for(int i=0; i<n; ++i)
+        ++it;
+    return f;
+}
+
+int main()
+{
+    const std::size_t base = pool_allocator::chunks();
+
+    // Chunks go back to the heap once their nodes are freed.
+    fib *s = make(20000);
+    assert(pool_allocator::chunks() > base+10);
+    delete s;
+
+    // What stays: a chunk for each node size in use, and a spare.
+    const std::size_t kept = pool_allocator::chunks();
+    assert(kept <= base+5);
+
+    // Nodes made on a thread that exited go back from here.
+    std::thread([&] { s = make(20000); }).join();
+    assert(pool_allocator::chunks() > base+10);
+    delete s;
+    assert(pool_allocator::chunks() <= kept);
+
+    // Nodes freed on another thread go back to this one's chunks.
+    s = make(20000);
+    std::thread([&] { delete s; }).join();
+    s = make(10);
+    delete s;
+    assert(pool_allocator::chunks() <= kept);
+
+    // Threads coming and going reuse the pools they leave.
+    for(int i=0; i<100; ++i)
+        std::thread([] { delete make(1000); }).join();
+    assert(pool_allocator::chunks() <= kept);
+
+    const int n = 200000;
+    std::cout<<"pool: "<<walk<long>(n)<<" ms, heap: "<<walk<unsigned long>(n)<<" ms"<<std::endl;
+    return 0;
+}
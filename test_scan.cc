@@ -0,0 +1,109 @@
+/*
+ * Copyright (c) 2011-2012, Attila Gobi and Zalan Szugyi
+ * All rights reserved.
+ *
+ * This software was developed by Attila Gobi and Zalan Szugyi.
+ * The project was supported by the European Union and co-financed by the
+ * European Social Fund (grant agreement no. TAMOP 4.2.1./B-09/1/KMR-2010-0003)
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "stream.h"
+#include "test_common.h"
+#include <chrono>
+#include <cstdlib>
+
+struct mean
+{
+    double operator()(double a, double b) const { return (a+b)/2; }
+};
+
+template<typename T>
+void check(const stream<T> &a, const stream<T> &b, std::size_t n)
+{
+    std::vector<T> x(n);
+    a.begin().fill(&x[0], n);
+    typename stream<T>::iterator it = b.begin();
+    for(std::size_t i=0; i<n; ++i) {
+        assert(x[i] == *it);
+        ++it;
+    }
+}
+
+template<typename S>
+double time(const S &s, std::vector<long> &r)
+{
+    std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
+    s.begin().fill(&r[0], r.size());
+    std::chrono::steady_clock::time_point t2 = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::milli>(t2-t1).count();
+}
+
+int main()
+{
+    // Workers even on one core, so that the two passes run.
+    setenv("STREAM_THREADS", "3", 0);
+
+    stream<long> one = 1l<<=one;
+    stream<long> nat = 0l<<=nat+one;
+    stream<long> sums = stream<long>::scan(std::plus<long>(), 0l, nat);
+    compare(sums, {0l, 0l, 1l, 3l, 6l, 10l, 15l}, 1);
+
+    // Reading itself one element back.
+    stream<long> pow2 = stream<long>::scan(std::plus<long>(), 1l, pow2);
+    compare(pow2, {1l, 2l, 4l, 8l, 16l, 32l}, 1);
+    stream<long> pow3 = stream<long>::scan(std::plus<long>(), 1l, pow3+pow3);
+    pow3.forget();
+    std::vector<long> p3(1000);
+    pow3.begin().fill(&p3[0], p3.size());
+    assert(p3[3] == 27);
+
+    // Not associative: one element after the other.
+    stream<double> half = .5<<=half;
+    stream<double> m = stream<double>::scan(mean(), 0., half);
+    compare(m, {0., .25, .375, .4375}, 1);
+
+    // Long runs on the pool, against the recursion they stand for.
+    stream<long> r = 0l<<=r+nat;
+    stream<long> x = stream<long>::scan(std::plus<long>(), 0l, nat);
+    check(x, r, 100000);
+    stream<long> y = stream<long>::scan(std::bit_xor<long>(), 0l, nat*nat);
+    stream<long> z = 0l<<=stream<long>::zipwith(std::bit_xor<long>(), z, nat*nat);
+    check(y, z, 100000);
+
+    const std::size_t n = 1<<22;
+    stream<long> one2 = 1l<<=one2;
+    stream<long> nat2 = 0l<<=nat2+one2;
+    nat2.forget();
+    stream<long> rec = 0l<<=rec+nat2;
+    rec.forget();
+    stream<long> one3 = 1l<<=one3;
+    stream<long> nat3 = 0l<<=nat3+one3;
+    nat3.forget();
+    stream<long> sc = stream<long>::scan(std::plus<long>(), 0l, nat3);
+    sc.forget();
+    std::vector<long> r1(n), r2(n);
+    const double t1 = time(rec, r1);
+    const double t2 = time(sc, r2);
+    assert(r1 == r2);
+    std::cout<<"recursion: "<<t1<<" ms, scan: "<<t2<<" ms"<<std::endl;
+    return 0;
+}
@@ -0,0 +1,108 @@
+/*
+ * Copyright (c) 2011-2012, Attila Gobi and Zalan Szugyi
+ * All rights reserved.
+ *
+ * This software was developed by Attila Gobi and Zalan Szugyi.
+ * The project was supported by the European Union and co-financed by the
+ * European Social Fund (grant agreement no. TAMOP 4.2.1./B-09/1/KMR-2010-0003)
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "stream.h"
+#include "test_common.h"
+
+// Checks at(i) against stepping for the first n elements.
+template<typename T>
+void same(const stream<T> &s, size_t n=300)
+{
+    typename stream<T>::iterator it = s.begin();
+    for(size_t i=0; i<n; ++i, ++it)
+        assert(s.at(i) == *it);
+}
+
+// Fibonacci numbers by doubling, modulo 2^64.
+void fib(unsigned long n, unsigned long &a, unsigned long &b)
+{
+    if(!n) {
+        a = 0;
+        b = 1;
+        return;
+    }
+    unsigned long c, d;
+    fib(n/2, c, d);
+    const unsigned long e = c*(2*d-c), f = c*c+d*d;
+    a = n&1 ? f : e;
+    b = n&1 ? e+f : f;
+}
+
+int main()
+{
+    stream<long> f = 0l<<=f+(1l<<=f);
+    same(f, 80);
+    compare(f.seek(10), {55l,89l,144l,233l}, 1);
+
+    stream<unsigned long> h = 0ul<<=h+(1ul<<=h);
+    unsigned long a, b;
+    fib(1000000000000ul, a, b);
+    assert(h.at(1000000000000ul) == a);
+    fib(999999999999ul, a, b);
+    assert(h.at(999999999999ul) == a);
+
+    // Constant coefficients, unary minus and delay.
+    stream<long> two = 2l<<=two, three = 3l<<=three;
+    stream<long> p = 1l<<=p*two - (0l<<=p);
+    same(p);
+    stream<long> q = 1l<<=-(three*q) + delay(3, 5, q);
+    same(q, 30);
+
+    // The powers of the matrix may overflow a long where the elements
+    // do not.
+    stream<long> z = 0l<<=z*two;
+    assert(z.at(1000000000000ul) == 0);
+
+    // Change in the coins 1, 2, 5 and 10.
+    stream<long> c1 = 1l<<=c1;
+    stream<long> c2 = delay(2, 0, c2) + c1;
+    stream<long> c5 = delay(5, 0, c5) + c2;
+    stream<long> c10 = delay(10, 0, c10) + c5;
+    same(c10);
+
+    // A stream evaluated in part, and ones that are not linear.
+    stream<long> g = 0l<<=g+(1l<<=g);
+    compare(g, {0l,1l,1l,2l,3l}, 1);
+    same(g, 80);
+    stream<unsigned long> r = 0ul<<=r+(1ul<<=r);
+    compare(r, {0ul,1ul,1ul,2ul,3ul}, 1);
+    fib(2000000000ul, a, b);
+    assert(r.at(2000000000ul) == a);
+    stream<long> q2 = 1l<<=-(three*q2) + delay(3, 5, q2);
+    compare(q2, {1l,2l,-1l,8l,-23l}, 1);
+    assert(q2.at(1000000000ul) == q.at(1000000000ul));
+    stream<long> sq = 2l<<=sq*sq;
+    compare(sq.seek(3), {256l,65536l}, 1);
+    stream<long> m = 1l<<=stream<long>::map([](long x) { return x+1; }, m);
+    same(m);
+    stream<long> e = 0l<<=expr(e) + c1;
+    same(e);
+    f.compile();
+    same(f, 80);
+
+    return 0;
+}
@@ -0,0 +1,97 @@
+/*
+ * Copyright (c) 2011-2012, Attila Gobi and Zalan Szugyi
+ * All rights reserved.
+ *
+ * This software was developed by Attila Gobi and Zalan Szugyi.
+ * The project was supported by the European Union and co-financed by the
+ * European Social Fund (grant agreement no. TAMOP 4.2.1./B-09/1/KMR-2010-0003)
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "stream.h"
+#include "test_common.h"
+#include <chrono>
+#include <cstdlib>
+
+// The first n terms of the product, one sum per term.
+template<typename T>
+std::vector<T> cauchy(const std::vector<T> &a, const std::vector<T> &b, std::size_t n)
+{
+    std::vector<T> c(n, T());
+    for(std::size_t i=0; i<n; ++i)
+        for(std::size_t j=0; j<=i; ++j)
+            c[i] = c[i] + a[j]*b[i-j];
+    return c;
+}
+
+template<typename T>
+std::vector<T> take(const stream<T> &s, std::size_t n)
+{
+    std::vector<T> x(n);
+    s.begin().fill(&x[0], n);
+    return x;
+}
+
+int main()
+{
+    stream<long> one = 1l<<=one;
+    stream<long> nat = 0l<<=nat+one;
+    compare(series_mul(one, one), {1l, 2l, 3l, 4l, 5l, 6l}, 1);
+    compare(series_mul(nat, one), {0l, 1l, 3l, 6l, 10l, 15l}, 1);
+
+    // C = 1 + x C^2, read one coefficient behind.
+    stream<long> cat = 1l<<=series_mul(cat, cat);
+    compare(cat, {1l, 1l, 2l, 5l, 14l, 42l, 132l, 429l, 1430l, 4862l}, 1);
+
+    // Past the transform threshold, wrapping around like long does.
+    const std::size_t n = 3000;
+    stream<long> sq = nat*nat*nat*nat*nat;
+    std::vector<long> a = take(sq, n), b = take(nat, n);
+    assert(take(stream<long>::series_mul(sq, nat), n) == cauchy(a, b, n));
+    assert(take(stream<long>::series_mul(sq, sq), n) == cauchy(a, a, n));
+    std::vector<long> c = take(cat, n);
+    assert(take(series_mul(cat, cat), n-1) == std::vector<long>(c.begin()+1, c.end()));
+
+    // Without transforms.
+    stream<double> half = .5<<=half;
+    stream<double> h = 1.<<=h*half;
+    stream<double> d = series_mul(h, h);
+    std::vector<double> dh = take(h, 200);
+    assert(take(d, 200) == cauchy(dh, dh, 200));
+
+    // Ways to change an amount into coins of 1, 2 and 5: 1/(1-x^k) as
+    // the series that is 1 at the multiples of k.
+    stream<long> c1 = one;
+    stream<long> c2 = 1l<<=0l<<=c2;
+    stream<long> c5 = 1l<<=0l<<=0l<<=0l<<=0l<<=c5;
+    compare(series_mul(series_mul(c1, c2), c5), {1l, 1l, 2l, 2l, 3l, 4l, 5l, 6l, 7l, 8l, 10l}, 1);
+
+    const std::size_t m = 100000;
+    stream<long> big = 1l<<=series_mul(big, big);
+    big.forget();
+    std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
+    std::vector<long> r = take(big, m);
+    std::chrono::steady_clock::time_point t2 = std::chrono::steady_clock::now();
+    assert(std::equal(r.begin(), r.begin()+n, c.begin()));
+    std::cout<<"catalan: "<<m<<" terms in "
+             <<std::chrono::duration<double, std::milli>(t2-t1).count()<<" ms"<<std::endl;
+    return 0;
+}
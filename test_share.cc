@@ -0,0 +1,176 @@
+/*
+ * Copyright (c) 2011-2012, Attila Gobi and Zalan Szugyi
+ * All rights reserved.
+ *
+ * This software was developed by Attila Gobi and Zalan Szugyi.
+ * The project was supported by the European Union and co-financed by the
+ * European Social Fund (grant agreement no. TAMOP 4.2.1./B-09/1/KMR-2010-0003)
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "stream.h"
+#include "test_common.h"
+
+// Nodes of long streams alive, and operations applied.
+long nodes = 0;
+long evals = 0;
+
+struct counting_allocator
+{
+    static void *allocate(std::size_t n)
+    {
+        ++nodes;
+        return pool_allocator::allocate(n);
+    }
+
+    static void deallocate(void *p, std::size_t n)
+    {
+        --nodes;
+        pool_allocator::deallocate(p, n);
+    }
+};
+
+template<>
+struct stream_allocator<long>
+{
+    typedef counting_allocator type;
+};
+
+struct mul
+{
+    long operator()(long a, long b) const
+    {
+        ++evals;
+        return a*b;
+    }
+};
+
+// Declared pure, for its counting does not matter to the results.
+template<>
+struct stream_pure<mul>: std::true_type { };
+
+long count(long x)
+{
+    ++evals;
+    return x;
+}
+
+stream<long> ones = 1l<<=ones;
+
+stream<long> square(const stream<long> &s)
+{
+    return stream<long>::zipwith(mul(), s, s);
+}
+
+// Reads n elements of s in chunks.
+void read(const stream<long> &s, std::size_t n)
+{
+    std::vector<long> v(1000);
+    stream<long>::iterator it = s.begin();
+    for(std::size_t i=0; i<n; i+=v.size())
+        it.fill(&v[0], v.size());
+}
+
+// Reads n elements of s through a copy, and returns the most nodes
+// alive meanwhile.
+long through(stream<long> s, std::size_t n)
+{
+    const long before = nodes;
+    long most = 0;
+    stream<long>::iterator it = s.begin();
+    for(std::size_t i=0; i<n; ++i, ++it)
+        most = std::max(most, nodes - before);
+    return most;
+}
+
+int main()
+{
+    // Both operands of s+s read the same elements.
+    stream<long> nat = 0l<<=nat+ones;
+    stream<long> c = stream<long>::map(count, nat);
+    stream<long> c2 = c+c;
+    read(c2, 10000);
+    assert(evals == 10000);
+
+    // Equal sub-streams are computed once.
+    evals = 0;
+    stream<long> s = square(nat) + square(nat);
+    compare(s, {0l,2l,8l,18l,32l}, 1);
+    read(s, 10000);
+    assert(evals == 10000);
+
+    evals = 0;
+    stream<long> t = (square(nat) + ones) * (square(nat) + ones);
+    compare(t, {1l,4l,25l,100l}, 1);
+    assert(evals == 4);
+
+    // Separate definitions compute their own.
+    evals = 0;
+    stream<long> x = square(nat) - ones;
+    stream<long> y = square(nat) + ones;
+    read(x, 5000);
+    compare(y, {1l,2l,5l,10l}, 1);
+    assert(evals == 5004);
+
+    // Operations not declared pure are not compared, with state or not.
+    evals = 0;
+    long k = 0;
+    auto f = [k](long a, long b) { ++evals; return a*b+k; };
+    stream<long> u = stream<long>::zipwith(f, nat, nat) + stream<long>::zipwith(f, nat, nat);
+    compare(u, {0l,2l,8l}, 1);
+    assert(evals == 6);
+
+    evals = 0;
+    auto g = [](long a, long b) { ++evals; return a*b; };
+    stream<long> u2 = stream<long>::zipwith(g, nat, nat) + stream<long>::zipwith(g, nat, nat);
+    compare(u2, {0l,2l,8l}, 1);
+    assert(evals == 6);
+
+    // The shared elements are dropped once both uses are past them.
+    stream<long> n2 = 0l<<=n2+ones;
+    stream<long> h = square(n2) + square(n2);
+    n2.forget();
+    h.forget();
+    const long before = nodes;
+    read(h, 1000000);
+    assert(nodes - before < 10000);
+
+    // A twin definition nobody reads holds nothing back.
+    stream<long> n3 = 0l<<=n3+ones;
+    stream<long> v = -(square(n3) + ones);
+    stream<long> v2 = -(square(n3) + ones);
+    n3.forget();
+    v.forget();
+    const long before2 = nodes;
+    read(v, 1000000);
+    assert(nodes - before2 < 10000);
+
+    // A copy of a forgotten stream forgets as well.
+    stream<long> w = 0l<<=w+(1l<<=w);
+    w.forget();
+    assert(through(w, 1000000) < 100);
+
+    // Lowered like a copy.
+    stream<long> p = square(nat) * ones + square(nat);
+    p.compile();
+    compare(p, {0l,2l,8l,18l}, 1);
+
+    return 0;
+}
@@ -0,0 +1,154 @@
+/*
+ * Copyright (c) 2011-2012, Attila Gobi and Zalan Szugyi
+ * All rights reserved.
+ *
+ * This software was developed by Attila Gobi and Zalan Szugyi.
+ * The project was supported by the European Union and co-financed by the
+ * European Social Fund (grant agreement no. TAMOP 4.2.1./B-09/1/KMR-2010-0003)
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define STREAM_STATS
+#include "stream.h"
+#include "test_common.h"
+
+struct twice
+{
+    int operator()(int x) const { return 2*x; }
+};
+
+// Reads n elements of a stream of its own, one at a time.
+void walk(int n)
+{
+    stream<int> one = 1<<=one;
+    stream<int> s = 0<<=s+one;
+    stream<int>::iterator it = s.begin();
+    for(int i=0; i<n; ++i)
+        ++it;
+}
+
+// Every node a block allocated is gone once its streams are.
+void check_freed()
+{
+    for(int k=0; k<stream_stats::kinds; ++k)
+        assert(stream_stats::of(stream_stats::kind(k)).live_bytes == 0);
+}
+
+int main()
+{
+    {
+        stream<int> one = 1<<=one;
+        stream<int> n = 0<<=n+one;
+        stream<int> m = stream<int>::map(twice(), n);
+        stream_stats::reset();
+
+        stream<int>::iterator it = m.begin();
+        for(int i=0; i<10; ++i) {
+            assert(*it == 2*i);
+            ++it;
+        }
+        stream_stats::print(std::cout);
+
+        // The map starts a generator once, which keeps one value per
+        // element read.
+        assert(stream_stats::of(stream_stats::map).deletes == 1);
+        assert(stream_stats::of(stream_stats::map2).allocs == 1);
+        assert(stream_stats::of(stream_stats::val).allocs >= 10);
+        assert(stream_stats::of(stream_stats::val).peak_bytes > 0);
+        assert(stream_stats::of(stream_stats::zip2).allocs == 1);
+    }
+    check_freed();
+
+    {
+        stream<int> a = 1<<=2<<=a;
+        stream<int> b = a;
+        stream_stats::reset();
+        compare(b, {1, 2}, 2);
+        assert(stream_stats::of(stream_stats::share).gets +
+               stream_stats::of(stream_stats::share).nexts > 0);
+    }
+    check_freed();
+
+    {
+        stream<int> d = delay(3, 7, d);
+        stream_stats::reset();
+        std::vector<int> r(6);
+        d.begin().fill(&r[0], 6);
+        assert(r == std::vector<int>(6, 7));
+        assert(stream_stats::of(stream_stats::delay).fills > 0);
+    }
+    check_freed();
+
+    // Every node type has a kind of its own.
+    {
+        stream<int> one = 1<<=one;
+        stream<int> n = 0<<=n+one;
+        stream<int> e = 0<<=expr(e)+expr(one);
+        stream<int> c = (n+one)*(n+one);
+        stream<int> p = 0<<=p+one;
+        p.compile();
+        // The producer reads streams nobody else does.
+        stream<int> k = 1<<=2<<=k;
+        stream<int> a = stream<int>::async(k+k, 4);
+        stream<int> s = stream<int>::scan(std::plus<int>(), 0, n);
+        stream<int> q = series_mul(one, one);
+        stream<int> w = window_sum(2, n);
+        stream_stats::reset();
+        compare(e, {0, 1, 2}, 1);
+        compare(c, {1, 4, 9}, 1);
+        compare(p, {0, 1, 2}, 1);
+        compare(a, {2, 4, 2}, 1);
+        compare(s, {0, 0, 1, 3}, 1);
+        compare(q, {1, 2, 3}, 1);
+        compare(w, {0, 1, 3}, 1);
+        stream_stats::print(std::cout);
+
+        const stream_stats::kind used[] = {
+            stream_stats::expr, stream_stats::expr2, stream_stats::cons,
+            stream_stats::machine, stream_stats::scan, stream_stats::scan2,
+            stream_stats::series, stream_stats::series2,
+            stream_stats::window, stream_stats::window2
+        };
+        for(stream_stats::kind k : used)
+            assert(stream_stats::of(k).gets + stream_stats::of(k).fills > 0);
+        assert(stream_stats::of(stream_stats::async).gets > 0);
+    }
+    check_freed();
+
+    // Threads count on their own without losing any.
+    {
+        stream_stats::reset();
+        walk(10000);
+        const stream_stats::counters one = stream_stats::of(stream_stats::val);
+        stream_stats::reset();
+        std::vector<std::thread> t;
+        for(int i=0; i<4; ++i)
+            t.push_back(std::thread(walk, 10000));
+        for(std::thread &x : t)
+            x.join();
+        const stream_stats::counters all = stream_stats::of(stream_stats::val);
+        assert(all.allocs == 4*one.allocs);
+        assert(all.deletes == 4*one.deletes);
+        assert(all.nexts == 4*one.nexts);
+    }
+    check_freed();
+    return 0;
+}
@@ -0,0 +1,122 @@
+/*
+ * Copyright (c) 2011-2012, Attila Gobi and Zalan Szugyi
+ * All rights reserved.
+ *
+ * This software was developed by Attila Gobi and Zalan Szugyi.
+ * The project was supported by the European Union and co-financed by the
+ * European Social Fund (grant agreement no. TAMOP 4.2.1./B-09/1/KMR-2010-0003)
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "stream.h"
+#include "test_common.h"
+#include <chrono>
+#include <cstdlib>
+
+template<typename T>
+std::vector<T> take(const stream<T> &s, std::size_t n)
+{
+    std::vector<T> x(n);
+    s.begin().fill(&x[0], n);
+    return x;
+}
+
+int main()
+{
+    stream<long> one = 1l<<=one;
+    stream<long> nat = 0l<<=nat+one;
+    compare(window_sum(3, nat), {0l, 1l, 3l, 6l, 9l, 12l, 15l}, 1);
+    compare(window_sum(1, nat), {0l, 1l, 2l, 3l}, 1);
+
+    stream<double> x = 3.<<=1.<<=4.<<=1.<<=5.<<=9.<<=2.<<=6.<<=x;
+    compare(window_min(3, x), {3., 1., 1., 1., 1., 1., 2., 2., 2., 1.}, 1);
+    compare(window_max(3, x), {3., 3., 4., 4., 5., 9., 9., 9., 6., 6.}, 1);
+    compare(window_mean(2, x), {3., 2., 2.5, 2.5, 3., 7., 5.5, 4., 4.5, 2.}, 1);
+
+    // Against the chains of delayed copies they stand for, element by
+    // element and in bulk.
+    stream<long> p = 1000003l<<=p;
+    stream<long> r = 0l<<=(r*r+nat) % p;
+    const std::size_t k = 7, n = 5000;
+    std::vector<stream<long> > d;
+    d.reserve(k);
+    d.push_back(r);
+    for(std::size_t j=1; j<k; ++j)
+        d.push_back(d.back() + delay(j, 0l, r));
+    std::vector<long> w = take(window_sum(k, r), n);
+    assert(w == take(d.back(), n));
+    stream<long> ws = window_sum(k, r);
+    stream<long>::iterator it = ws.begin();
+    for(std::size_t i=0; i<n; ++i, ++it)
+        assert(*it == w[i]);
+
+    std::vector<long> v = take(r, n);
+    std::vector<long> lo = take(window_min(k, r), n), hi = take(window_max(k, r), n);
+    for(std::size_t i=0; i<n; ++i) {
+        const std::size_t j = i+1 < k ? 0 : i+1-k;
+        assert(lo[i] == *std::min_element(&v[j], &v[i]+1));
+        assert(hi[i] == *std::max_element(&v[j], &v[i]+1));
+    }
+
+    // Reading itself one element back: the sum of the last two, Fibonacci.
+    stream<long> fib = 1l<<=window_sum(2, fib);
+    compare(fib, {1l, 1l, 2l, 3l, 5l, 8l, 13l, 21l}, 1);
+
+    // A spike far above the rest leaves no rounding behind once it has
+    // left the window, read element by element and in bulk.
+    stream<double> ones = 1.<<=ones;
+    stream<double> spike = 1e17<<=ones;
+    std::vector<double> ss = take(window_sum(4, spike), 100);
+    std::vector<double> sm = take(window_mean(4, spike), 100);
+    stream<double> ss2 = window_sum(4, spike);
+    stream<double>::iterator sit = ss2.begin();
+    for(std::size_t i=0; i<100; ++i, ++sit) {
+        assert(*sit == ss[i]);
+        if(i >= 4) {
+            assert(ss[i] == 4.);
+            assert(sm[i] == 1.);
+        }
+    }
+
+    // An empty window is refused up front, NDEBUG or not.
+    int refused = 0;
+    try { window_sum(0, nat); } catch(const std::invalid_argument &) { ++refused; }
+    try { window_min(0, x); } catch(const std::invalid_argument &) { ++refused; }
+    try { window_max(0, x); } catch(const std::invalid_argument &) { ++refused; }
+    try { window_mean(0, x); } catch(const std::invalid_argument &) { ++refused; }
+    assert(refused == 4);
+
+    // A million samples in a window of 10^5, in constant time each.
+    const std::size_t m = 1000000;
+    stream<long> one2 = 1l<<=one2;
+    stream<long> nat2 = 0l<<=nat2+one2;
+    nat2.forget();
+    const long k2 = 100000;
+    stream<long> big = window_sum(k2, nat2);
+    big.forget();
+    std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
+    std::vector<long> b = take(big, m);
+    std::chrono::steady_clock::time_point t2 = std::chrono::steady_clock::now();
+    assert(b[m-1] == k2*long(m-1) - k2*(k2-1)/2);
+    std::cout<<"window_sum: "<<m<<" elements in "
+             <<std::chrono::duration<double, std::milli>(t2-t1).count()<<" ms"<<std::endl;
+    return 0;
+}